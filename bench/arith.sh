@@ -0,0 +1,50 @@
+#!/bin/sh
+# Cost of the arithmetic builtins on 1 to a million arguments.
+#
+# Stores (+ 1 1 ...) with N arguments and evaluates it about a million
+# arguments' worth of times, at least ten, with --no-vm, where every call
+# goes through builtin_add, and with --no-jit, where the VM hands the
+# operands to the same kernel. Runs with only the definitions are
+# subtracted, so the times include the cost of eval itself.
+#
+# usage: sh bench/arith.sh [path/to/lispy]
+
+. "$(dirname "$0")/common.sh"
+
+LISPY=${1:-./lispy}
+
+# The list of 10^$1 ones is built by joining ten copies $1 times, and
+# evaluated 10^$2 times if asked
+script() {
+  echo '(def {l} {1})'
+  repeat "$1" '(def {l} (join l l l l l l l l l l))'
+  echo '(def {code} (join {+} l))'
+  nest code "$2"
+  if [ "$3" = run ]; then
+    echo "(eval k$2)"
+  fi
+}
+
+tmp=${TMPDIR:-/tmp}/lispy-arith-bench.$$
+for k in 0 1 2 3 4 5 6; do
+  depth=$((6 - k))
+  if [ $depth -lt 1 ]; then
+    depth=1
+  fi
+  script $k $depth run >"$tmp.code"
+  script $k $depth >"$tmp.base"
+  for mode in tree vm; do
+    case $mode in
+    tree) flag=--no-vm ;;
+    vm) flag=--no-jit ;;
+    esac
+    code_t=$(run "$LISPY" "$tmp.code" $flag)
+    base_t=$(run "$LISPY" "$tmp.base" $flag)
+    t=$((code_t - base_t))
+    awk -v k=$k -v depth=$depth -v mode=$mode -v t=$t \
+      'BEGIN { n = 10 ^ k; calls = 10 ^ depth;
+               printf "%8d arguments  %-4s %12.1f ns/call  %6.2f ns/argument\n",
+                 n, mode, t / calls, t / (calls * n) }'
+  done
+done
+rm -f "$tmp.base" "$tmp.code"
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Cost of bignum arithmetic on numbers of 10 to 100000 digits.
+#
+# Defines a with N digits and p, about a squared, then times a + a,
+# a * a and p / a inside a comparison with 0, so that only 0 is printed.
+# Stored code evaluates each operation ten times per level, with fewer
+# levels for longer numbers. Building a and p is not counted, since the
+# same script without its final eval is timed and subtracted. A product
+# of N digits takes about N^1.58 time with Karatsuba's method, against
+# N^2 for schoolbook multiplication and division.
+#
+# usage: sh bench/bignum.sh [path/to/lispy]
+
+. "$(dirname "$0")/common.sh"
+
+LISPY=${1:-./lispy}
+
+# N random looking digits, starting with a 9
+digits() {
+  awk -v n="$1" 'BEGIN { srand(1); s = "9";
+    for (i = 1; i < n; i++) s = s int(rand() * 10); print s }'
+}
+
+# script DIGITS DEPTH EXPRESSION [run]
+script() {
+  echo "(def {a} $(digits "$1"))"
+  echo '(def {p} (+ (* a a) 12345))'
+  echo "(def {code} {< $3 0})"
+  nest code "$2"
+  if [ "$4" = run ]; then
+    echo "(eval k$2)"
+  fi
+}
+
+tmp=${TMPDIR:-/tmp}/lispy-bignum-bench.$$
+for n in 10 100 1000 10000 100000; do
+  for name in add mul div; do
+    depth=$((7 - ${#n}))
+    case $name in
+    add)
+      expr='(+ a a)'
+      # Sums are cheap enough to run at least 10^4 times
+      if [ $depth -lt 4 ]; then
+        depth=4
+      fi
+      ;;
+    mul) expr='(* a a)' ;;
+    div) expr='(/ p a)' ;;
+    esac
+    script $n $depth "$expr" >"$tmp.base"
+    script $n $depth "$expr" run >"$tmp.code"
+    t=$(($(run "$LISPY" "$tmp.code") - $(run "$LISPY" "$tmp.base")))
+    awk -v n=$n -v depth=$depth -v name=$name -v t=$t \
+      'BEGIN { printf "%8d digits  %-3s %12.0f ns/operation\n", n, name,
+               t / 10 ^ depth }'
+  done
+done
+rm -f "$tmp.base" "$tmp.code"
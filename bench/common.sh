@@ -0,0 +1,61 @@
+# Helpers shared by the benchmarks, which source this file with
+#
+#   . "$(dirname "$0")/common.sh"
+
+now() {
+  date +%s%N
+}
+
+# run LISPY SCRIPT [FLAG...]
+# Best of three runs of LISPY on SCRIPT, in nanoseconds
+run() {
+  lispy=$1
+  input=$2
+  shift 2
+  best=
+  for _ in 1 2 3; do
+    start=$(now)
+    "$lispy" "$@" <"$input" >/dev/null
+    t=$(($(now) - start))
+    if [ -z "$best" ] || [ $t -lt "$best" ]; then
+      best=$t
+    fi
+  done
+  echo "$best"
+}
+
+# repeat N LINE
+# Prints LINE N times
+repeat() {
+  count=0
+  while [ $count -lt "$1" ]; do
+    echo "$2"
+    count=$((count + 1))
+  done
+}
+
+# nest CODE DEPTH
+# Defines k1 to kDEPTH, each of which evaluates the one below it ten
+# times, starting from the stored code CODE, so that one (eval kDEPTH)
+# runs CODE 10^DEPTH times without much parsing
+nest() {
+  inner=$1
+  level=0
+  while [ $level -lt "$2" ]; do
+    level=$((level + 1))
+    echo "(def {k$level} {head (list$(printf ' (eval %s)' $inner $inner \
+      $inner $inner $inner $inner $inner $inner $inner $inner))})"
+    inner=k$level
+  done
+}
+
+# evals CODE LINES
+# Stores CODE, which may use the number x and the list l, and evaluates
+# it a thousand times on each of LINES lines
+evals() {
+  echo "(def {x} 7)"
+  echo "(def {l} {1 2 3 4 5 6 7 8})"
+  echo "(def {code} {$1})"
+  nest code 3
+  repeat "$2" "(eval k3)"
+}
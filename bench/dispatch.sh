@@ -0,0 +1,37 @@
+#!/bin/sh
+# Switch against threaded dispatch in the bytecode VM.
+#
+# Evaluates stored arithmetic 100000 times with two builds of the
+# interpreter, the default one, which dispatches with computed goto, and
+# one built with -DLVM_SWITCH, both with --no-jit. The same runs
+# evaluating a trivial expression are subtracted.
+#
+# usage: sh bench/dispatch.sh path/to/lispy path/to/lispy-switch
+
+. "$(dirname "$0")/common.sh"
+
+THREADED=${1:-./lispy}
+SWITCH=${2:-./lispy-switch}
+NLINES=100
+
+tmp=${TMPDIR:-/tmp}/lispy-dispatch-bench.$$
+evals "list 0" $NLINES >"$tmp.base"
+for name in consts vars; do
+  case $name in
+  consts) code='+ (* 2 (- 10 4)) (/ (* 3 3) 3) (- (+ 1 2 3) (* 2 2)) 7' ;;
+  vars) code='- (+ (* x 2) (* x x)) (/ (+ x 1) 2) (- x 1) (* (- x 3) (+ x 4))' ;;
+  esac
+  evals "$code" $NLINES >"$tmp.code"
+  for build in threaded switch; do
+    case $build in
+    threaded) lispy=$THREADED ;;
+    switch) lispy=$SWITCH ;;
+    esac
+    code_t=$(run "$lispy" "$tmp.code" --no-jit)
+    base_t=$(run "$lispy" "$tmp.base" --no-jit)
+    t=$((code_t - base_t))
+    awk -v name=$name -v build=$build -v t=$t -v evals=$((NLINES * 1000)) \
+      'BEGIN { printf "%-6s %-8s %8.1f ns/eval\n", name, build, t / evals }'
+  done
+done
+rm -f "$tmp.base" "$tmp.code"
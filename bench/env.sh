@@ -0,0 +1,50 @@
+#!/bin/sh
+# Cost of a global symbol lookup as the environment grows.
+#
+# Defines N globals, then evaluates 100 lines of 1000 references to the
+# most recently defined one. The same run with the references replaced
+# by number literals is subtracted, leaving the time spent in lookups.
+#
+# usage: sh bench/env.sh [path/to/lispy]
+
+. "$(dirname "$0")/common.sh"
+
+LISPY=${1:-./lispy}
+NLINES=100
+REFS=1000
+
+script() {
+  n=$1
+  ref=$2
+  printf '(def {'
+  i=1
+  while [ $i -le "$n" ]; do
+    printf 's%d ' $i
+    i=$((i + 1))
+  done
+  printf '}'
+  i=1
+  while [ $i -le "$n" ]; do
+    printf ' %d' $i
+    i=$((i + 1))
+  done
+  echo ')'
+  line="(+"
+  i=0
+  while [ $i -lt $REFS ]; do
+    line="$line $ref"
+    i=$((i + 1))
+  done
+  repeat $NLINES "$line)"
+}
+
+tmp=${TMPDIR:-/tmp}/lispy-env-bench.$$
+for n in 10 100 1000 10000; do
+  script $n "s$n" >"$tmp.sym"
+  script $n 1 >"$tmp.num"
+  sym=$(run "$LISPY" "$tmp.sym")
+  num=$(run "$LISPY" "$tmp.num")
+  awk -v n=$n -v d=$((sym - num)) -v refs=$((NLINES * REFS)) \
+    'BEGIN { printf "%6d globals  %8.1f ns/lookup\n", n, d / refs }'
+done
+rm -f "$tmp.sym" "$tmp.num"
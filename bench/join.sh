@@ -0,0 +1,55 @@
+#!/bin/sh
+# Throughput of join.
+#
+# Joins two stored lists of N elements each, and separately N lists of
+# one element each in a single call, 100 times per size. The runs with
+# only the definitions are subtracted. With linear time joins the cost
+# per element stays flat as N grows.
+#
+# usage: sh bench/join.sh [path/to/lispy]
+
+. "$(dirname "$0")/common.sh"
+
+LISPY=${1:-./lispy}
+NLINES=100
+
+# Two lists of 8 << doublings elements, joined NLINES times if asked
+pairs() {
+  echo '(def {a} {1 2 3 4 5 6 7 8})'
+  repeat "$1" '(def {a} (join a a))'
+  echo '(def {b} a)'
+  repeat "$2" '(head (join a b))'
+}
+
+# A stored join of n single element lists, evaluated NLINES times if asked
+singles() {
+  line="(def {s} {join"
+  i=0
+  while [ $i -lt "$1" ]; do
+    line="$line {$i}"
+    i=$((i + 1))
+  done
+  echo "$line})"
+  repeat "$2" '(head (eval s))'
+}
+
+report() {
+  awk -v what="$1" -v n=$2 -v d=$(($3 - $4)) -v elems=$(($5 * NLINES)) \
+    'BEGIN { printf "%-16s %8d  %8.1f ns/element\n", what, n, d / elems }'
+}
+
+tmp=${TMPDIR:-/tmp}/lispy-join-bench.$$
+for d in 7 10 13 16; do
+  n=$((8 << d))
+  pairs $d $NLINES >"$tmp.join"
+  pairs $d 0 >"$tmp.base"
+  report "two lists of" $n "$(run "$LISPY" "$tmp.join")" \
+    "$(run "$LISPY" "$tmp.base")" $((2 * n))
+done
+for n in 4000 16000 64000; do
+  singles $n $NLINES >"$tmp.join"
+  singles $n 0 >"$tmp.base"
+  report "singletons" $n "$(run "$LISPY" "$tmp.join")" \
+    "$(run "$LISPY" "$tmp.base")" $n
+done
+rm -f "$tmp.join" "$tmp.base"
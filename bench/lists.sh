@@ -0,0 +1,28 @@
+#!/bin/sh
+# Cost of building long lists by repeated joins.
+#
+# Starts from an 8-element Q-expression and doubles it with join until it
+# holds N elements, then sums it. Time per element should stay flat as N
+# grows if appending to a list is amortised constant time.
+#
+# usage: sh bench/lists.sh [path/to/lispy]
+
+. "$(dirname "$0")/common.sh"
+
+LISPY=${1:-./lispy}
+
+script() {
+  doublings=$1
+  echo '(def {l} {1 2 3 4 5 6 7 8})'
+  repeat "$doublings" '(def {l} (join l l))'
+  echo '(eval (join {+} l))'
+}
+
+tmp=${TMPDIR:-/tmp}/lispy-lists-bench.$$
+for d in 11 13 15 17; do
+  script $d >"$tmp"
+  t=$(run "$LISPY" "$tmp")
+  awk -v n=$((8 << d)) -v t=$t \
+    'BEGIN { printf "%8d elements  %6.1f ns/element\n", n, t / n }'
+done
+rm -f "$tmp"
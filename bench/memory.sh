@@ -0,0 +1,66 @@
+#!/bin/sh
+# Memory footprint of large Q-expressions, in bytes per element.
+#
+# Builds a Q-expression of N elements of each kind, reads the pool
+# occupancy before and after with (pool-stats) and adds the 8 byte cell
+# pointer every element costs in its parent. Symbol names live in the
+# intern table and are shared by every occurrence, so they are not
+# counted.
+#
+# An endless tail call loop that takes views with head and tail should
+# run in constant memory, so its resident size is sampled after one and
+# after three seconds and should not grow.
+#
+# usage: sh bench/memory.sh [path/to/lispy] [N]
+
+LISPY=${1:-./lispy}
+N=${2:-100000}
+
+measure() {
+  name=$1
+  elem=$2
+  {
+    echo "(pool-stats)"
+    printf '(def {big} {'
+    i=0
+    while [ $i -lt "$N" ]; do
+      printf '%s ' "$elem"
+      i=$((i + 1))
+    done
+    echo '})'
+    echo "(pool-stats)"
+  } | "$LISPY" | grep 'node size' | awk -v n="$N" -v name="$name" '
+    {
+      for (i = 1; i <= NF; i++) {
+        if ($i == "live:") { live[NR] = $(i + 1) + 0 }
+        if ($i == "size:") { size = $(i + 1) + 0 }
+      }
+    }
+    END {
+      printf "%-8s %8d elements  %6.2f bytes/element\n", name, n,
+             (live[2] - live[1]) * size / n + 8
+    }'
+}
+
+measure number 7
+measure symbol x
+measure qexpr '{}'
+
+rss() {
+  awk '/^VmRSS:/ { print $2 }' "/proc/$1/status"
+}
+
+loop() {
+  printf '%s\n' \
+    '(def {loop} {eval (eval (head (join (list {eval loop}) (tail {1 2 3}))))})' \
+    '(eval loop)' | "$LISPY" > /dev/null &
+  pid=$!
+  sleep 1
+  before=$(rss $pid)
+  sleep 2
+  after=$(rss $pid)
+  kill $pid
+  printf "%-8s %8d kB after 1s  %8d kB after 3s\n" tail "$before" "$after"
+}
+
+loop
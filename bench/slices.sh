@@ -0,0 +1,50 @@
+#!/bin/sh
+# Cost of head and tail as lists grow.
+#
+# Builds a list of N elements and a stored expression that walks down it
+# with 100 nested tails before taking the head of the rest, then
+# evaluates that expression many times. The same run with the stored
+# expression returned instead of evaluated is subtracted. If tail is
+# constant time the cost per call does not depend on N.
+#
+# usage: sh bench/slices.sh [path/to/lispy]
+
+. "$(dirname "$0")/common.sh"
+
+LISPY=${1:-./lispy}
+NLINES=100
+EVALS=100
+DEPTH=100
+
+script() {
+  doublings=$1
+  call=$2
+  echo '(def {l} {1 2 3 4 5 6 7 8})'
+  repeat "$doublings" '(def {l} (join l l))'
+  walk="l"
+  i=0
+  while [ $i -lt $DEPTH ]; do
+    walk="(tail $walk)"
+    i=$((i + 1))
+  done
+  echo "(def {w} {head $walk})"
+  line="(list"
+  i=0
+  while [ $i -lt $EVALS ]; do
+    line="$line $call"
+    i=$((i + 1))
+  done
+  repeat $NLINES "$line)"
+}
+
+tmp=${TMPDIR:-/tmp}/lispy-slices-bench.$$
+for d in 7 10 13 16; do
+  script $d "(eval w)" >"$tmp.walk"
+  script $d "w" >"$tmp.base"
+  walk=$(run "$LISPY" "$tmp.walk")
+  base=$(run "$LISPY" "$tmp.base")
+  awk -v n=$((8 << d)) -v d=$((walk - base)) \
+    -v calls=$((NLINES * EVALS * DEPTH)) \
+    'BEGIN { printf "%8d elements  %10.1f ns/tail\n", n, d / calls }'
+done
+rm -f "$tmp.walk" "$tmp.base"
@@ -0,0 +1,53 @@
+#!/bin/sh
+# Cost of packed vectors, in nanoseconds per element.
+#
+# Builds a list of N numbers by repeated joins and packs it into a vector,
+# then times packing the list, unpacking the vector, element-wise
+# arithmetic, and vmap, vfilter and vreduce with builtins on it, against
+# the sum of the list with + and vmap over the list, which calls + once
+# per element, for comparison.
+# Each operation runs on about 16 million elements in all. Runs with only
+# the definitions are subtracted.
+#
+# usage: sh bench/vectors.sh [path/to/lispy]
+
+. "$(dirname "$0")/common.sh"
+
+LISPY=${1:-./lispy}
+TOTAL=16777216
+
+# script DOUBLINGS EXPRESSION LINES
+script() {
+  echo '(def {l} {1 2 3 4 5 6 7 8})'
+  repeat "$1" '(def {l} (join l l))'
+  echo '(def {x} (vec l))'
+  repeat "$3" "$2"
+}
+
+tmp=${TMPDIR:-/tmp}/lispy-vectors-bench.$$
+for d in 9 13 17; do
+  n=$((8 << d))
+  lines=$((TOTAL / n))
+  script $d '' 0 >"$tmp.base"
+  base=$(run "$LISPY" "$tmp.base")
+  for name in sum vec vlist v+ v+k v* vmap vfilter vreduce vmap-l; do
+    case $name in
+    sum) expr='(eval (join {+} l))' ;;
+    vec) expr='(vlen (vec l))' ;;
+    vlist) expr='(head (vlist x))' ;;
+    v+) expr='(vlen (v+ x x))' ;;
+    v+k) expr='(vlen (v+ x 7))' ;;
+    'v*') expr='(vlen (v* x x))' ;;
+    vmap) expr='(vlen (vmap + x 7))' ;;
+    vfilter) expr='(vlen (vfilter > x 4))' ;;
+    vreduce) expr='(vreduce max x)' ;;
+    vmap-l) expr='(head (vmap + l 7))' ;;
+    esac
+    script $d "$expr" $lines >"$tmp.code"
+    t=$(($(run "$LISPY" "$tmp.code") - base))
+    awk -v n=$n -v name=$name -v t=$t -v total=$((lines * n)) \
+      'BEGIN { printf "%8d elements  %-7s %6.2f ns/element\n", n, name,
+               t / total }'
+  done
+done
+rm -f "$tmp.base" "$tmp.code"
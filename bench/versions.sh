@@ -0,0 +1,40 @@
+#!/bin/sh
+# Cost of storing a new version of a long list.
+#
+# Builds a stored list of N elements, then evaluates a stored update that
+# redefines it as its own tail with one element appended 100000 times.
+# The same run evaluating a stored definition of a number instead is
+# subtracted. With structural sharing the cost per update grows with
+# log N rather than N.
+#
+# usage: sh bench/versions.sh [path/to/lispy]
+
+. "$(dirname "$0")/common.sh"
+
+LISPY=${1:-./lispy}
+NLINES=1000
+EVALS=100
+
+script() {
+  echo '(def {l} {1 2 3 4 5 6 7 8})'
+  repeat "$1" '(def {l} (join l l))'
+  echo "(def {u} {$2})"
+  line="(list"
+  i=0
+  while [ $i -lt $EVALS ]; do
+    line="$line (eval u)"
+    i=$((i + 1))
+  done
+  repeat $NLINES "$line)"
+}
+
+tmp=${TMPDIR:-/tmp}/lispy-versions-bench.$$
+for d in 7 10 13 16; do
+  script $d "def {n} 0" >"$tmp.base"
+  base=$(run "$LISPY" "$tmp.base")
+  script $d "def {l} (join (tail l) {9})" >"$tmp.update"
+  t=$(($(run "$LISPY" "$tmp.update") - base))
+  awk -v n=$((8 << d)) -v t=$t -v updates=$((NLINES * EVALS)) \
+    'BEGIN { printf "%8d elements  %8.1f ns/update\n", n, t / updates }'
+done
+rm -f "$tmp.base" "$tmp.update"
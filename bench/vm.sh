@@ -0,0 +1,38 @@
+#!/bin/sh
+# Speed of the bytecode VM and the JIT against the tree walker.
+#
+# Stores arithmetic on constants, arithmetic on variables and a
+# list-processing expression, then evaluates each 100000 times with the
+# JIT, with --no-jit and with --no-vm. Runs with only the definitions
+# are subtracted, so the times include the cost of eval itself.
+#
+# usage: sh bench/vm.sh [path/to/lispy]
+
+. "$(dirname "$0")/common.sh"
+
+LISPY=${1:-./lispy}
+NLINES=100
+
+tmp=${TMPDIR:-/tmp}/lispy-vm-bench.$$
+for name in arith vars lists; do
+  case $name in
+  arith) code='+ (* 2 (- 10 4)) (/ (* 3 3) 3) (- (+ 1 2 3) (* 2 2)) 7' ;;
+  vars) code='- (+ (* x 2) (* x x)) (/ (+ x 1) 2) (- x 1) (* (- x 3) (+ x 4))' ;;
+  lists) code='join (tail l) (head (tail (tail l))) (list 1 2 3) l' ;;
+  esac
+  evals "$code" $NLINES >"$tmp.code"
+  evals "$code" 0 >"$tmp.base"
+  for mode in tree vm jit; do
+    case $mode in
+    tree) flag=--no-vm ;;
+    vm) flag=--no-jit ;;
+    jit) flag= ;;
+    esac
+    code_t=$(run "$LISPY" "$tmp.code" $flag)
+    base_t=$(run "$LISPY" "$tmp.base" $flag)
+    t=$((code_t - base_t))
+    awk -v name=$name -v mode=$mode -v t=$t -v evals=$((NLINES * 1000)) \
+      'BEGIN { printf "%-6s %-5s %8.1f ns/eval\n", name, mode, t / evals }'
+  done
+done
+rm -f "$tmp.base" "$tmp.code"
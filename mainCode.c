@@ -1,7 +1,28 @@
+/* mmap for the JIT, which -std=c99 hides otherwise */
+#define _DEFAULT_SOURCE
 #include "mpc.h" // We can also use quotes "" instead of <> as quotes will look in the curr directory
+#include <limits.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+
+/* Hot arithmetic is compiled to native code on x86-64 Linux, unless built
+ * with -DLJIT_DISABLE */
+#if defined(__x86_64__) && defined(__linux__) && !defined(LJIT_DISABLE)
+#define LJIT
+#include <sys/mman.h>
+#endif
+
+/* Long arithmetic reductions use SSE4.2 or AVX2 where the CPU has them,
+ * unless built with -DLSIMD_DISABLE */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(LSIMD_DISABLE)
+#define LSIMD
+#include <immintrin.h>
+#endif
+
 #ifdef _WIN32
 #include <string.h>
 
@@ -19,6 +40,7 @@ void add_history(char *unused) {}
 
 #else
 #include <editline/readline.h>
+#include <sys/time.h>
 #endif
 
 // enum definitions
@@ -27,7 +49,20 @@ void add_history(char *unused) {}
 // b. Error
 // c. Symbols
 // d. S expression
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN };
+// e. Packed vector of numbers
+// f. Bignum, an integer too large for a long
+// g. Free (internal marker for unused pool slots)
+enum {
+  LVAL_NUM,
+  LVAL_ERR,
+  LVAL_SYM,
+  LVAL_SEXPR,
+  LVAL_QEXPR,
+  LVAL_FUN,
+  LVAL_VEC,
+  LVAL_BIG,
+  LVAL_FREE
+};
 // 2. Error Types
 //  a. Division By Zero
 //  b. Bad Operand
@@ -43,6 +78,7 @@ typedef struct lval lval;
 typedef struct lenv lenv;
 
 typedef lval *(*lbuiltin)(lenv *, lval *);
+typedef int (*lkernel)(lval **, int, long *);
 
 /*
  * ################################
@@ -50,17 +86,214 @@ typedef lval *(*lbuiltin)(lenv *, lval *);
  * ################################
  * */
 
+/* Each type only ever uses one payload, so they share storage. The count
+ * and reference count sit next to the type tag to keep the whole node at
+ * 16 bytes. A vector keeps its count numbers unboxed in ints. A bignum
+ * keeps its magnitude in limbs, least significant first, with count the
+ * number of limbs, negated for negative numbers. A view is a Q-expression
+ * whose cells belong to another list, see lval_slice, and a tree is one
+ * stored as a persistent vector. A compiled node has an entry in the code
+ * cache. */
 typedef struct lval {
-  long num;
-  int type;
+  unsigned int type : 5;
+  unsigned int view : 1;
+  unsigned int tree : 1;
+  unsigned int compiled : 1;
+  unsigned int refcount : 23;
+  unsigned int mark : 1;
+  int count;
 
-  char *err;
-  char *sym;
-  lbuiltin fun;
+  union {
+    long num;
+    char *err;
+    char *sym;
+    lbuiltin fun;
+    struct lval **cell;
+    long *ints;
+    uint32_t *limbs;
+    struct lvec *vec;
+    struct lval *next_free;
+  };
+} lval;
+
+/*
+ * Small integers are not allocated at all: they live inline in the lval
+ * pointer word with the low bit set. Real lval structs are at least word
+ * aligned, so their low bit is always clear. Use LVAL_TYPE and
+ * LVAL_NUM_VALUE instead of touching ->type and ->num directly.
+ * */
+#define LVAL_FIXNUM_MIN (LONG_MIN >> 1)
+#define LVAL_FIXNUM_MAX (LONG_MAX >> 1)
+#define LVAL_IS_FIXNUM(v) (((uintptr_t)(v)) & 1)
+#define LVAL_FIXNUM(x) ((lval *)((((uintptr_t)(x)) << 1) | 1))
+#define LVAL_TYPE(v) (LVAL_IS_FIXNUM(v) ? LVAL_NUM : (v)->type)
+#define LVAL_NUM_VALUE(v)                                                      \
+  (LVAL_IS_FIXNUM(v) ? (long)((intptr_t)(v) >> 1) : (v)->num)
+
+/*
+ * Values are immutable once shared. lval_ref hands out another reference
+ * and lval_del drops one, freeing the node with the last. Anything that
+ * mutates a value in place must first call lval_unshare on it. A value
+ * whose count saturates at LVAL_REFCOUNT_MAX is never freed.
+ * */
+#define LVAL_REFCOUNT_MAX 0x7FFFFF
+
+/* Cell arrays keep their capacity in the word just before the first
+ * element, which leaves the node itself at 16 bytes */
+#define LVAL_CAPACITY(v) ((v)->cell ? (int)((size_t *)(v)->cell)[-1] : 0)
+
+/* Never collect before this many allocations */
+#define LGC_MIN_THRESHOLD 65536
+
+/*
+ * ################################
+ * #### PERSISTENT VECTORS ########
+ * ################################
+ * */
+
+/* Branching factor of the trie behind a tree Q-expression */
+#define LVEC_BITS 5
+#define LVEC_WIDTH (1 << LVEC_BITS)
+#define LVEC_MASK (LVEC_WIDTH - 1)
+
+/* Stored Q-expressions at least this long become trees */
+#define LVEC_MIN_SIZE 64
+
+/* A trie node. Inner nodes point at nodes one level down, leaves at
+ * elements. Nodes are shared between versions and reference counted. */
+typedef struct lvnode {
+  int refcount;
+  int mark;
+  void *slot[LVEC_WIDTH];
+} lvnode;
+
+/* One version of a vector: the elements at positions start to
+ * start + count - 1 of the trie. Each tree node has its own. */
+typedef struct lvec {
+  lvnode *root;
+  int shift;
+  int start;
+} lvec;
+
+/*
+ * ################################
+ * #### LINE REGION ###############
+ * ################################
+ * */
+
+/* A chunk of line region memory */
+typedef struct lchunk {
+  struct lchunk *next;
+  size_t size;
+  char data[];
+} lchunk;
 
+/* How far the line region and the nursery had got at some point, see
+ * lregion_release */
+typedef struct lmark {
+  int npins;
+  lval *nursery;
+  int overflowed;
+  lchunk *chunk;
+  char *top;
+  size_t used;
+} lmark;
+
+/*
+ * ################################
+ * #### BIGNUMS ###################
+ * ################################
+ * */
+
+/* Unsigned magnitude of an integer in 32-bit limbs, least significant
+ * first, without leading zeros, and its sign. Zero has no limbs and is
+ * never negative. */
+typedef struct lbig {
+  uint32_t *d;
+  int n;
+  int neg;
+} lbig;
+
+/* Limbs in a long */
+#define LBIG_LONG_LIMBS ((int)(sizeof(long) / sizeof(uint32_t)))
+
+/* Products of numbers this many limbs long or longer use Karatsuba. At
+ * least 4, or splitting would not make the operands any shorter. */
+#define LBIG_KARATSUBA 32
+
+/*
+ * ################################
+ * #### BYTECODE ##################
+ * ################################
+ * */
+
+/* VM instructions. Each is one int, the opcode in the low byte and its
+ * argument in the rest. */
+enum {
+  LOP_CONST,  /* push constant arg */
+  LOP_LOAD,   /* push the value of global binding arg */
+  LOP_CALL,   /* pop arg values and evaluate them as an S-expression */
+  LOP_ARITH,  /* CALL of an arithmetic operator, see LOP_ARITH_ARG */
+  LOP_ARITHK, /* CONST then a binary ARITH, see LOP_ARITH_ARG */
+  LOP_RET     /* return the value on top of the stack */
+};
+
+#define LOP(op, arg) ((op) | ((arg) << 8))
+
+/* LOP_ARITH packs the number of operands and the operator into its
+ * argument, LOP_ARITHK the constant and the operator */
+#define LOP_ARITH_ARG(n, op) (((n) << 2) | (op))
+
+/* Dispatch with computed goto where the compiler has it, unless built
+ * with -DLVM_SWITCH */
+#if defined(__GNUC__) && !defined(LVM_SWITCH)
+#define LVM_THREADED
+#endif
+
+/* Code unit for a stored Q-expression, compiled once it is warm.
+ * Constants are borrowed from the expression, which the code never
+ * outlives. Symbols are resolved to their global bindings when the code
+ * is compiled. */
+typedef struct lcode {
+  lval *src;
+  int tier;
+  long hits;
+  long time;
+  int *ins;
   int count;
-  struct lval **cell;
-} lval;
+  int capacity;
+  lval **consts;
+  int nconsts;
+  int constcap;
+  struct lbinding **globals;
+  int nglobals;
+  int globalcap;
+  int maxstack;
+  struct ljit *jit;
+} lcode;
+
+/* Execution tiers, from the tree walker up to native code */
+enum { LTIER_TREE, LTIER_VM, LTIER_JIT, LTIER_COUNT };
+
+/* Evaluations of a code unit before it is compiled to bytecode, and
+ * before it is compiled to native code */
+#define LVM_THRESHOLD 2
+#define LJIT_THRESHOLD 100
+
+/* Interval of the profiling timer behind tier-stats, in microseconds of
+ * CPU time. The kernel may deliver ticks less often. */
+#define LTIER_TICK_US 1000
+
+/* Native code for a code unit, see ljit_compile. The code takes the
+ * values of the numbers it loads and stores its result, returning 0
+ * instead whenever it cannot finish. */
+typedef struct ljit {
+  int (*fn)(long *args, long *out);
+  size_t size;
+  struct lbinding **binds;
+  int *ops;
+  int nbinds;
+} ljit;
 
 /*
  * ################################
@@ -68,11 +301,34 @@ typedef struct lval {
  * ################################
  * */
 
+/* Every symbol name is stored once in a global intern table. Symbols
+ * point at the name inside their entry, so two symbols are equal exactly
+ * when their sym pointers are. */
+typedef struct lsymbol {
+  unsigned int hash;
+  char name[];
+} lsymbol;
+
+/* A single binding. Bindings are allocated one by one so that their
+ * address stays fixed while the table around them grows, and compiled
+ * code refers to them directly. A symbol that code refers to before it
+ * is defined has a binding with a NULL val. */
+typedef struct lbinding {
+  char *sym;
+  unsigned int hash;
+  lval *val;
+} lbinding;
+
+/* Bindings are found through an open addressing table with linear
+ * probing on the interned name, and also kept in definition order for
+ * iteration */
 struct lenv {
   int count;
-  // list of lval* and chars*
-  char **syms;
-  lval **vals;
+  int capacity;
+  lbinding **order;
+
+  int nslots;
+  lbinding **slots;
 };
 
 // adding definition of eval
@@ -83,17 +339,61 @@ lval *lval_sym(char *s);
 lval *lval_sexpr(void);
 lval *lval_qexpr(void);
 lval *lval_fun(lbuiltin func);
+lval *lval_vec(int n);
 lval *lval_add(lval *v, lval *x);
 void lval_expr_print(lval *v, char open, char close);
 void lval_print(lval *v);
 lval *lval_read(mpc_ast_t *t);
 void lval_del(lval *v);
-lval *lval_eval_sexpr(lenv *e, lval *v);
 lval *lval_eval(lenv *e, lval *v);
+lval *lval_walk(lenv *e, lval *v);
+lval *lval_call(lenv *e, lval *v);
+lcode *lcode_get(lval *v);
+lcode *lcode_find(lval *v);
+void lcode_build(lcode *c, lenv *e);
+void ltier_init(void);
+void ltier_tick(int sig);
+void lcode_forget(lval *v);
+void lcode_emit(lcode *c, int op, int arg);
+int lcode_const(lcode *c, lval *v);
+int lcode_global(lcode *c, lenv *e, lval *sym);
+int lcode_compile(lcode *c, lenv *e, lval *v, int depth);
+int lvm_eligible(lval *v);
+lval *lvm_eval(lenv *e, lval *v);
+lval *lvm_run(lenv *e, lcode *c);
+lval *lvm_call(lenv *e, int n, int tail);
+int lvm_arith_op(lval *v);
+int lvm_arith(int op, lval **v, int n, long *out);
+ljit *ljit_compile(lcode *c);
+int ljit_run(lenv *e, ljit *j, long *out);
+void ljit_free(ljit *j);
 lval *lval_pop(lval *v, int i);
 lval *lval_take(lval *v, int i);
 lval *builtin(lenv *e, lval *a, char *func);
 lval *builtin_op(lenv *e, lval *a, char *op);
+lval *builtin_arith(lenv *e, lval *a, int op);
+int lkernel_add(lval **v, int n, long *out);
+int lkernel_sub(lval **v, int n, long *out);
+int lkernel_mul(lval **v, int n, long *out);
+int lkernel_div(lval **v, int n, long *out);
+int lkernel_min(lval **v, int n, long *out);
+int lkernel_max(lval **v, int n, long *out);
+int lkernel_vec(int op, long *x, const long *y, long k, int n);
+int lkernel_elem(int op, long a, long b, long *out);
+int lkernel_fold(int op, long acc, const long *x, int n, long *out);
+void lsimd_init(void);
+int lsimd_sum_finish(lval **v, int i, int n, long *lanes, int nlanes,
+                     long *out);
+int lsimd_extreme_finish(lval **v, int i, int n, long *lanes, int nlanes,
+                         int max, long *out);
+int lsimd_sum_sse(lval **v, int n, long *out);
+int lsimd_sum_avx2(lval **v, int n, long *out);
+int lsimd_extreme_sse(lval **v, int n, int max, long *out);
+int lsimd_extreme_avx2(lval **v, int n, int max, long *out);
+int lsimd_apply_sse(int op, long *x, const long *y, long k, int n);
+int lsimd_apply_avx2(int op, long *x, const long *y, long k, int n);
+int lsimd_fold_sse(int op, const long *x, int n, long *out);
+int lsimd_fold_avx2(int op, const long *x, int n, long *out);
 lval *builtin_head(lenv *e, lval *a);
 lval *builtin_tail(lenv *e, lval *a);
 lval *builtin_list(lenv *e, lval *a);
@@ -103,16 +403,110 @@ lval *builtin_def(lenv *e, lval *a);
 lval *lval_join(lval *x, lval *y);
 char *ltype_name(int i);
 lval *lval_copy(lval *v);
+lval *lval_ref(lval *v);
+lval *lval_unshare(lval *v);
+int lval_mutable(lval *v);
 lenv *lenv_new(void);
 void lenv_del(lenv *e);
 void lenv_put(lenv *e, lval *k, lval *v);
 lval *lenv_get(lenv *e, lval *v);
+unsigned int lsym_hash(char *s);
+lsymbol *lsym_intern(char *s);
+lbinding **lenv_slot(lenv *e, char *sym, unsigned int hash);
+lbinding *lenv_binding(lenv *e, lval *k);
+void lenv_grow(lenv *e);
 void lenv_add_builtin(lenv *e, char *name, lbuiltin func);
 void lenv_add_builtins(lenv *e);
 lval *builtin_add(lenv *e, lval *a);
 lval *builtin_sub(lenv *e, lval *a);
 lval *builtin_mul(lenv *e, lval *a);
 lval *builtin_div(lenv *e, lval *a);
+lval *builtin_min(lenv *e, lval *a);
+lval *builtin_max(lenv *e, lval *a);
+lval *builtin_vec(lenv *e, lval *a);
+lval *builtin_vlist(lenv *e, lval *a);
+lval *builtin_vlen(lenv *e, lval *a);
+lval *builtin_vget(lenv *e, lval *a);
+lval *builtin_vslice(lenv *e, lval *a);
+lval *builtin_varith(lenv *e, lval *a, int op);
+lval *builtin_vadd(lenv *e, lval *a);
+lval *builtin_vsub(lenv *e, lval *a);
+lval *builtin_vmul(lenv *e, lval *a);
+lval *builtin_vdiv(lenv *e, lval *a);
+lval *builtin_cmp(lenv *e, lval *a, int op);
+lval *builtin_lt(lenv *e, lval *a);
+lval *builtin_gt(lenv *e, lval *a);
+lval *builtin_le(lenv *e, lval *a);
+lval *builtin_ge(lenv *e, lval *a);
+lval *builtin_eq(lenv *e, lval *a);
+lval *builtin_ne(lenv *e, lval *a);
+int lval_vec_apply(lval *x, int op, lval *y);
+int lelem_op(lval *f);
+lval *lelem_get(lval *v, int i);
+lval *lelem_call(lenv *e, lval *f, lval *x, lval *y, lval **rest, int nrest);
+int lelem_fast(lval *a, int op);
+lval *builtin_vmap(lenv *e, lval *a);
+lval *builtin_vfilter(lenv *e, lval *a);
+lval *builtin_vreduce(lenv *e, lval *a);
+lval *builtin_pool_stats(lenv *e, lval *a);
+void lpool_refill(void);
+lval *lval_alloc(void);
+void lval_free(lval *v);
+lval *lpool_alloc(void);
+void lnursery_init(void);
+void lnursery_collect(void);
+void lnursery_rewind(lval *top);
+int lval_has_young(lval *v);
+lval *lval_promote(lval *v);
+void *lregion_alloc(size_t n);
+void *lregion_realloc(void *p, size_t n);
+void lregion_reset(void);
+void *lval_mem_alloc(lval *v, size_t n);
+void *lval_mem_realloc(lval *v, void *p, size_t n);
+void lval_mem_free(lval *v, void *p);
+void lval_cells_reserve(lval *v, int n);
+void lval_cells_shrink(lval *v);
+void lval_cells_free(lval *v);
+void lregion_pin(lval *v);
+void lregion_unpin(int n);
+lmark lregion_mark(void);
+void lregion_release(lmark *m);
+lval *lval_slice(lval *v, int start, int len);
+lval *lval_index(lval *v, int i);
+lvnode *lvnode_own(lvnode *n, int shift);
+void lvnode_release(lvnode *n, int shift);
+lvnode *lvec_leaf(lval *v, int i);
+void lvec_put(lval *v, int i, lval *x);
+lval *lvec_build(lval *v);
+lval *lvec_unshare(lval *v);
+lval *lvec_flatten(lval *v, int start, int len);
+void lbig_from_long(lbig *b, long x, uint32_t *buf);
+void lbig_view(lbig *b, lval *v, uint32_t *buf);
+lbig lbig_dup(const lbig *b);
+int lbig_trim(const uint32_t *d, int n);
+int lbig_cmp_mag(const uint32_t *a, int an, const uint32_t *b, int bn);
+int lbig_cmp(const lbig *a, const lbig *b);
+uint32_t lbig_addto(uint32_t *r, int rn, const uint32_t *a, int an);
+void lbig_subfrom(uint32_t *r, int rn, const uint32_t *a, int an);
+lbig lbig_add(const lbig *a, const lbig *b, int sub);
+void lbig_mul_mag(uint32_t *r, const uint32_t *a, int an, const uint32_t *b,
+                  int bn);
+lbig lbig_mul(const lbig *a, const lbig *b);
+void lbig_div_mag(uint32_t *q, const uint32_t *u, int un, const uint32_t *v,
+                  int vn);
+lbig lbig_div(const lbig *a, const lbig *b);
+lval *lbig_lval(lbig *b);
+lval *lbig_arith(lval *a, int op);
+lval *lbig_read(const char *s);
+void lbig_print(lval *v);
+int lgc_mark_vec(lvnode *n, int shift, int sp);
+void lgc_push(lval *v);
+void lgc_pop(void);
+void lgc_mark(lval *v);
+void lgc_sweep(void);
+void lgc_collect(lenv *e);
+lval *builtin_gc_stats(lenv *e, lval *a);
+lval *builtin_tier_stats(lenv *e, lval *a);
 
 #define LASSERT(args, cond, fmt, ...)                                          \
   {                                                                            \
@@ -123,10 +517,10 @@ lval *builtin_div(lenv *e, lval *a);
     }                                                                          \
   }
 #define LASSERT_TYPE(func, args, index, expect)                                \
-  LASSERT(args, args->cell[index]->type == expect,                             \
+  LASSERT(args, LVAL_TYPE(args->cell[index]) == expect,                        \
           "Function '%s' passed incorrect type for argument %i. Got %s, "      \
           "Expected %s.",                                                      \
-          func, index, ltype_name(args->cell[index]->type),                    \
+          func, index, ltype_name(LVAL_TYPE(args->cell[index])),               \
           ltype_name(expect));
 
 #define LASSERT_COUNT(func, args, num)                                         \
@@ -139,6 +533,111 @@ lval *builtin_div(lenv *e, lval *a);
   LASSERT(args, args->cell[index]->count != 0,                                 \
           "Function '%s' passed {} for argument %i.", func, index);
 
+/* Nursery state, see lnursery_collect */
+static struct {
+  lval *start;
+  lval *top;
+  lval *end;
+  int overflowed;
+
+  long collections;
+  long promoted;
+} lnursery;
+
+#define LVAL_IS_YOUNG(v)                                                       \
+  ((uintptr_t)(v) >= (uintptr_t)lnursery.start &&                             \
+   (uintptr_t)(v) < (uintptr_t)lnursery.end)
+
+/* Line region state, see lregion_reset */
+static struct {
+  lchunk *chunks;
+  char *top;
+  char *end;
+  mpc_ast_t *ast;
+
+  lval **pins;
+  int npins;
+  int pincap;
+
+  size_t used;
+  size_t peak;
+} lregion;
+
+/* Garbage collector state, see lgc_collect */
+static struct {
+  int enabled;
+  long allocated;
+  long threshold;
+
+  lval **roots;
+  int nroots;
+  int rootcap;
+  lval **marks;
+  int markcap;
+
+  long collections;
+  double last_pause;
+  double max_pause;
+  double total_pause;
+  long live_nodes;
+  long live_bytes;
+} lgc = {0, 0, LGC_MIN_THRESHOLD};
+
+/* VM operand stack, shared by nested runs, see lvm_run */
+static struct {
+  int enabled;
+  int jit;
+  lval **stack;
+  int sp;
+  int cap;
+} lvm = {1, 1};
+
+/* Continuation stack of the tree walker, shared by nested evaluations.
+ * Each frame is an S-expression whose children are being evaluated and
+ * the index of the child being evaluated now. */
+static struct {
+  struct leframe {
+    lval *v;
+    int i;
+  } * frames;
+  int count;
+  int capacity;
+} leval;
+
+/* A call in tail position may hand back LVAL_TAIL instead of its value,
+ * leaving the Q-expression to evaluate in pending, see builtin_eval */
+static struct {
+  int ok;
+  lval *pending;
+} ltail;
+
+static lval ltail_marker;
+#define LVAL_TAIL (&ltail_marker)
+
+/* Evaluations and nanoseconds of CPU time per tier, and the tier and
+ * code unit running now, see lvm_eval. The tick handler reads current
+ * and unit, so every store to them has to happen where the code says. */
+static struct {
+  long evals[LTIER_COUNT];
+  long time[LTIER_COUNT];
+  volatile sig_atomic_t current;
+  lcode *volatile unit;
+  long last;
+} ltier = {{0}, {0}, -1, NULL, 0};
+
+/* Shortest run of operands worth handing to the vector kernels */
+#define LSIMD_MIN 16
+
+/* Vector reductions over runs of fixnums, picked for the CPU by
+ * lsimd_init and left NULL where the scalar loops are used instead */
+static struct {
+  int enabled;
+  int (*sum)(lval **v, int n, long *out);
+  int (*extreme)(lval **v, int n, int max, long *out);
+  int (*apply)(int op, long *x, const long *y, long k, int n);
+  int (*fold)(int op, const long *x, int n, long *out);
+} lsimd = {1};
+
 int main(int argc, char **argv) {
   /* Create Some Parsers */
   mpc_parser_t *Number = mpc_new("number");
@@ -159,9 +658,28 @@ int main(int argc, char **argv) {
     lispy    : /^/  <expr>* /$/ ;             \
   ",
             Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  /* Command line flags */
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--gc") == 0) {
+      lgc.enabled = 1;
+    }
+    if (strcmp(argv[i], "--no-vm") == 0) {
+      lvm.enabled = 0;
+    }
+    if (strcmp(argv[i], "--no-jit") == 0) {
+      lvm.jit = 0;
+    }
+    if (strcmp(argv[i], "--no-simd") == 0) {
+      lsimd.enabled = 0;
+    }
+  }
+
   puts("Lispy Version 0.0.0.0.1");
   puts("Press Ctrl+c to Exit\n");
   /* Initialize an environment*/
+  lnursery_init();
+  ltier_init();
+  lsimd_init();
   lenv *e = lenv_new();
   lenv_add_builtins(e);
 
@@ -182,9 +700,15 @@ int main(int argc, char **argv) {
       /* On Success Print the AST */
       //      mpc_ast_print(r.output);
       //     mpc_ast_delete(r.output);
-      lval *x = lval_eval(e, lval_read(r.output));
+      lregion.ast = r.output;
+      lval *x = lval_read(r.output);
+      /* Lines themselves are only ever walked */
+      ltier.current = LTIER_TREE;
+      x = lval_eval(e, x);
+      ltier.current = -1;
       lval_println(x);
       lval_del(x);
+      lregion_reset();
     } else {
       /* Otherwise Print the Error */
       mpc_err_print(r.error);
@@ -198,223 +722,2301 @@ int main(int argc, char **argv) {
 
 /*
  * ################################
- * #### LISP TYPES ################
+ * #### LVAL POOL ALLOCATOR #######
  * ################################
  * */
 
-lval *lval_num(long x) {
-  lval *v = malloc(sizeof(lval));
-  v->num = x;
-  v->type = LVAL_NUM;
-  return v;
-}
+/* Number of lval structs carved out of each slab */
+#define LPOOL_SLAB_SIZE 1024
 
-lval *lval_err(char *fmt, ...) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_ERR;
+/* A slab is one large allocation holding many lval structs */
+typedef struct lslab {
+  struct lslab *next;
+  lval vals[LPOOL_SLAB_SIZE];
+} lslab;
 
-  /* Create a va list and initialize it */
-  va_list va;
-  va_start(va, fmt);
+/* Free lval structs are typed LVAL_FREE and chained through next_free */
+static struct {
+  lslab *slabs;
+  lval *free;
+  long nslabs;
+  long live;
+} lpool;
 
-  /* Allocate 512 bytes of space */
-  v->err = malloc(512);
+/* Refill the free list with a fresh slab */
+void lpool_refill(void) {
+  lslab *s = malloc(sizeof(lslab));
+  s->next = lpool.slabs;
+  lpool.slabs = s;
+  lpool.nslabs++;
 
-  /* printf the error string with a max of 511 characters */
-  vsnprintf(v->err, 511, fmt, va);
+  /* Thread the slab onto the free list back to front so that
+   * allocation hands out structs in address order */
+  for (int i = LPOOL_SLAB_SIZE - 1; i >= 0; i--) {
+    lval *f = &s->vals[i];
+    f->type = LVAL_FREE;
+    f->next_free = lpool.free;
+    lpool.free = f;
+  }
+}
 
-  /* Reallocate to number of bytes actually used */
-  v->err = realloc(v->err, strlen(v->err) + 1);
+lval *lpool_alloc(void) {
+  if (!lpool.free) {
+    lpool_refill();
+  }
+  lval *v = lpool.free;
+  lpool.free = v->next_free;
+  lpool.live++;
+  lgc.allocated++;
 
-  va_end(va);
+  v->refcount = 1;
+  v->mark = 0;
+  v->view = 0;
+  v->tree = 0;
+  v->compiled = 0;
   return v;
-  ;
 }
 
-lval *lval_sym(char *s) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
-  return v;
+void lval_free(lval *v) {
+  if (v->compiled) {
+    lcode_forget(v);
+  }
+  v->type = LVAL_FREE;
+  /* Young nodes are reclaimed all at once by lnursery_collect */
+  if (LVAL_IS_YOUNG(v)) {
+    return;
+  }
+  v->next_free = lpool.free;
+  lpool.free = v;
+  lpool.live--;
 }
 
-lval *lval_sexpr(void) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_SEXPR;
-  v->count = 0;
-  v->cell = NULL;
-  return v;
-}
+/*
+ * ################################
+ * #### NURSERY ###################
+ * ################################
+ * */
 
-lval *lval_qexpr(void) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_QEXPR;
-  v->count = 0;
-  v->cell = NULL;
-  return v;
+/*
+ * Nearly every value dies before the REPL line that created it is
+ * printed, so new nodes are bump allocated from a nursery and only
+ * values stored into the environment are promoted into the pool by
+ * lenv_put. Between lines nothing young can be reachable any more, and
+ * a minor collection is just resetting the bump pointer.
+ *
+ * To keep pointers from old nodes into the nursery out of the picture,
+ * lval_unshare never lets an old node be mutated in place. The one
+ * exception is a line that filled the whole nursery: the rest of its
+ * nodes come from the pool, and lval_promote has to look inside old
+ * values for young children until the line ends.
+ * */
+
+/* Number of nodes in the nursery */
+#ifndef LNURSERY_SIZE
+#define LNURSERY_SIZE 65536
+#endif
+
+void lnursery_init(void) {
+  lnursery.start = malloc(sizeof(lval) * LNURSERY_SIZE);
+  lnursery.top = lnursery.start;
+  lnursery.end = lnursery.start + LNURSERY_SIZE;
+  lnursery.overflowed = 0;
 }
 
-lval *lval_fun(lbuiltin func) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
-  v->fun = func;
+lval *lval_alloc(void) {
+  if (lnursery.top == lnursery.end) {
+    lnursery.overflowed = 1;
+    return lpool_alloc();
+  }
+  lval *v = lnursery.top++;
+  v->refcount = 1;
+  v->mark = 0;
+  v->view = 0;
+  v->tree = 0;
+  v->compiled = 0;
   return v;
 }
 
-lval *lval_read_num(mpc_ast_t *t) {
-  errno = 0;
-  long x = strtol(t->contents, NULL, 10);
-  return errno != ERANGE ? lval_num(x) : lval_err("invalid num");
+/* Minor collection, only valid while no young value is reachable. The
+ * cell arrays and strings of young nodes go with the line region. */
+void lnursery_collect(void) {
+  lnursery_rewind(lnursery.start);
+  lnursery.overflowed = 0;
+  lnursery.collections++;
 }
 
-lval *lval_read(mpc_ast_t *t) {
-
-  /* If number or symbol, return conversion to that type */
-  if (strstr(t->tag, "number")) {
-    return lval_read_num(t);
-  }
-  if (strstr(t->tag, "symbol")) {
-    return lval_sym(t->contents);
-  }
-  /* If root (>) or sexpr then create empty list */
-  lval *x = NULL;
-  if (strcmp(t->tag, ">") == 0) {
-    x = lval_sexpr();
-  }
-  if (strstr(t->tag, "sexpr")) {
-    x = lval_sexpr();
+/* Free the young nodes from top on, none of which may be reachable */
+void lnursery_rewind(lval *top) {
+  /* With the collector on, dead young trees were never deleted, so they
+   * still hold on to their tries */
+  if (lgc.enabled) {
+    for (lval *v = top; v < lnursery.top; v++) {
+      if (v->type == LVAL_QEXPR && v->tree) {
+        lvnode_release(v->vec->root, v->vec->shift);
+      }
+    }
   }
+  lnursery.top = top;
+}
 
-  if (strstr(t->tag, "qexpr")) {
-    x = lval_qexpr();
+/* Whether v depends on anything that goes away with the current line */
+int lval_has_young(lval *v) {
+  if (LVAL_IS_FIXNUM(v)) {
+    return 0;
   }
-
-  /* Fill the list with any valid expression contained within */
-  for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) {
-      continue;
-    }
-    if (strcmp(t->children[i]->contents, ")") == 0) {
-      continue;
-    }
-    if (strcmp(t->children[i]->contents, "{") == 0) {
-      continue;
-    }
-    if (strcmp(t->children[i]->contents, "}") == 0) {
-      continue;
-    }
-    if (strcmp(t->children[i]->tag, "regex") == 0) {
-      continue;
+  if (LVAL_IS_YOUNG(v) || v->view) {
+    return 1;
+  }
+  /* Elements of a trie are always old */
+  if ((v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) && !v->tree) {
+    for (int i = 0; i < v->count; i++) {
+      if (lval_has_young(v->cell[i])) {
+        return 1;
+      }
     }
-    x = lval_add(x, lval_read(t->children[i]));
   }
-  return x;
+  return 0;
 }
 
-lval *lval_add(lval *v, lval *x) {
-  v->count++;
-  v->cell = realloc(v->cell, sizeof(lval *) * v->count);
-  v->cell[v->count - 1] = x;
-  return v;
-}
+/* Return a reference to a value equal to v that contains no young nodes */
+lval *lval_promote(lval *v) {
+  if (LVAL_IS_FIXNUM(v)) {
+    return v;
+  }
+  if (!LVAL_IS_YOUNG(v) && !(lnursery.overflowed && lval_has_young(v))) {
+    return lval_ref(v);
+  }
 
-void lval_del(lval *v) {
+  lval *x = lpool_alloc();
+  x->type = v->type;
+  lnursery.promoted++;
 
   switch (v->type) {
-  /* Do nothing special for number type of functions */
-  case LVAL_NUM:
   case LVAL_FUN:
+    x->fun = v->fun;
+    break;
+  case LVAL_NUM:
+    x->num = v->num;
     break;
-
-  /* For Err or Sym free the string data */
   case LVAL_ERR:
-    free(v->err);
+    x->err = malloc(strlen(v->err) + 1);
+    strcpy(x->err, v->err);
     break;
   case LVAL_SYM:
-    free(v->sym);
+    x->sym = v->sym;
+    x->count = v->count;
+    break;
+  case LVAL_VEC:
+    x->count = v->count;
+    x->ints = malloc(sizeof(long) * (v->count ? v->count : 1));
+    memcpy(x->ints, v->ints, sizeof(long) * v->count);
+    break;
+  case LVAL_BIG:
+    x->count = v->count;
+    x->limbs = malloc(sizeof(uint32_t) * abs(v->count));
+    memcpy(x->limbs, v->limbs, sizeof(uint32_t) * abs(v->count));
     break;
-
-  /* If Sexpr then delete all elements inside */
-  case LVAL_SEXPR:
   case LVAL_QEXPR:
+  case LVAL_SEXPR:
+    x->count = v->count;
+    /* A tree only needs a version of its own, a long list becomes one */
+    if (v->tree) {
+      x->tree = 1;
+      x->vec = malloc(sizeof(lvec));
+      *x->vec = *v->vec;
+      x->vec->root->refcount++;
+      break;
+    }
+    if (v->type == LVAL_QEXPR && v->count >= LVEC_MIN_SIZE) {
+      x->count = 0;
+      lvec_build(x);
+      for (int i = 0; i < v->count; i++) {
+        lvec_put(x, i, lval_promote(v->cell[i]));
+        x->count++;
+      }
+      break;
+    }
+    x->cell = NULL;
+    lval_cells_reserve(x, v->count);
     for (int i = 0; i < v->count; i++) {
-      lval_del(v->cell[i]);
+      x->cell[i] = lval_promote(v->cell[i]);
     }
-    /* Also free the memory allocated to contain the pointers */
-    free(v->cell);
     break;
   }
-
-  /* Free the memory allocated for the "lval" struct itself */
-  free(v);
+  return x;
 }
 
 /*
  * ################################
- * #### EVALUATION FUNCTION ##########
+ * #### LINE REGION ###############
  * ################################
  * */
 
-lval *lval_eval_sexpr(lenv *e, lval *v) {
-  /* Evaluate Children */
-  for (int i = 0; i < v->count; i++) {
-    v->cell[i] = lval_eval(e, v->cell[i]);
-  }
-  /* Error checking in the childreb */
-  for (int i = 0; i < v->count; i++) {
-    if (v->cell[i]->type == LVAL_ERR) {
-      return lval_take(v, i);
-    }
+/*
+ * Everything a REPL line needs only while it runs is owned by the line
+ * region: the parsed AST, the nursery, and the cell arrays and error
+ * strings of young nodes, which are bump allocated from region chunks.
+ * lregion_reset drops all of it at once after the result is printed.
+ * Each region block starts with its capacity, so that growing a cell
+ * array one element at a time still only copies it a logarithmic number
+ * of times.
+ * */
+
+/* Bytes per region chunk, larger blocks get a chunk of their own */
+#ifndef LREGION_CHUNK_SIZE
+#define LREGION_CHUNK_SIZE (1 << 20)
+#endif
+
+void *lregion_alloc(size_t n) {
+  /* Keep every block pointer aligned */
+  size_t cap = (n + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  size_t need = sizeof(size_t) + cap;
+
+  if (!lregion.top || (size_t)(lregion.end - lregion.top) < need) {
+    size_t size = need > LREGION_CHUNK_SIZE ? need : LREGION_CHUNK_SIZE;
+    lchunk *c = malloc(sizeof(lchunk) + size);
+    c->next = lregion.chunks;
+    c->size = size;
+    lregion.chunks = c;
+    lregion.top = c->data;
+    lregion.end = c->data + size;
   }
 
-  /* Empty Expression */
-  if (v->count == 0) {
-    return v;
+  size_t *block = (size_t *)lregion.top;
+  *block = cap;
+  lregion.top += need;
+  lregion.used += need;
+  if (lregion.used > lregion.peak) {
+    lregion.peak = lregion.used;
   }
+  return block + 1;
+}
 
-  /* Single Expression */
-  if (v->count == 1) {
-    return lval_take(v, 0);
+void *lregion_realloc(void *p, size_t n) {
+  if (!p) {
+    return lregion_alloc(n);
   }
+  size_t cap = ((size_t *)p)[-1];
+  if (n <= cap) {
+    return p;
+  }
+  void *q = lregion_alloc(n > 2 * cap ? n : 2 * cap);
+  memcpy(q, p, cap);
+  return q;
+}
 
-  /* If all of above is not matched, then it has to be starting with a symbol */
+/* Keep v alive until the end of the line, taking over the reference */
+void lregion_pin(lval *v) {
+  if (lregion.npins == lregion.pincap) {
+    lregion.pincap = lregion.pincap ? lregion.pincap * 2 : 64;
+    lregion.pins = realloc(lregion.pins, sizeof(lval *) * lregion.pincap);
+  }
+  lregion.pins[lregion.npins++] = v;
+}
 
-  lval *f = lval_pop(v, 0);
-  if (f->type != LVAL_FUN) {
-    lval_del(f);
-    lval_del(v); // Throw error
-    return lval_err("first element is not a function");
+/* Let go of every pin but the first n, once the views they keep alive
+ * are unreachable */
+void lregion_unpin(int n) {
+  while (lregion.npins > n) {
+    lval_del(lregion.pins[--lregion.npins]);
   }
+}
 
-  /* Call Function to get result */
-  lval *res = f->fun(e, v);
-  lval_del(f);
-  return res;
+lmark lregion_mark(void) {
+  lmark m = {lregion.npins, lnursery.top,  lnursery.overflowed,
+             lregion.chunks, lregion.top, lregion.used};
+  return m;
 }
 
-lval *lval_eval(lenv *e, lval *v) {
-  /*Evaluate Sexpressions */
-  if (v->type == LVAL_SYM) {
-    lval *x = lenv_get(e, v);
-    lval_del(v);
-    return x;
+/* Drop everything the line has allocated since m, like lregion_reset
+ * does for the whole line. Only valid while none of it is reachable. */
+void lregion_release(lmark *m) {
+  lregion_unpin(m->npins);
+  lnursery_rewind(m->nursery);
+  lnursery.overflowed = m->overflowed;
+  while (lregion.chunks != m->chunk) {
+    lchunk *c = lregion.chunks;
+    lregion.chunks = c->next;
+    free(c);
   }
-  if (v->type == LVAL_SEXPR) {
-    return lval_eval_sexpr(e, v);
-  }
-  return v;
+  lregion.top = m->top;
+  lregion.end = m->chunk ? m->chunk->data + m->chunk->size : NULL;
+  lregion.used = m->used;
 }
 
-/*
- * ################################
- * #### BUILTIN FUNCTION ##########
- * ################################
- * */
+/* End of a REPL line: nothing allocated by it is reachable any more */
+void lregion_reset(void) {
+  lregion_unpin(0);
 
-/* add all predefined builtin */
-void lenv_add_builtins(lenv *e) {
-  /* list functions */
+  lnursery_collect();
+
+  if (lregion.ast) {
+    mpc_ast_delete(lregion.ast);
+    lregion.ast = NULL;
+  }
+
+  /* Keep the oldest chunk for the next line if it is a standard one */
+  lchunk *keep = NULL;
+  while (lregion.chunks) {
+    lchunk *c = lregion.chunks;
+    lregion.chunks = c->next;
+    if (!lregion.chunks && c->size == LREGION_CHUNK_SIZE) {
+      keep = c;
+    } else {
+      free(c);
+    }
+  }
+  lregion.chunks = keep;
+  lregion.top = keep ? keep->data : NULL;
+  lregion.end = keep ? keep->data + keep->size : NULL;
+  lregion.used = 0;
+}
+
+/* Storage owned by a node comes from the region while it is young */
+void *lval_mem_alloc(lval *v, size_t n) {
+  return LVAL_IS_YOUNG(v) ? lregion_alloc(n) : malloc(n);
+}
+
+void *lval_mem_realloc(lval *v, void *p, size_t n) {
+  return LVAL_IS_YOUNG(v) ? lregion_realloc(p, n) : realloc(p, n);
+}
+
+void lval_mem_free(lval *v, void *p) {
+  if (!LVAL_IS_YOUNG(v)) {
+    free(p);
+  }
+}
+
+/*
+ * ################################
+ * #### CELL ARRAYS ###############
+ * ################################
+ * */
+
+/* Make room for at least n cells, growing the capacity geometrically so
+ * that appending one element at a time is amortised constant time */
+void lval_cells_reserve(lval *v, int n) {
+  int cap = LVAL_CAPACITY(v);
+  if (n <= cap) {
+    return;
+  }
+  cap = cap * 2 > n ? cap * 2 : n;
+  if (cap < 4) {
+    cap = 4;
+  }
+
+  size_t *block = v->cell ? (size_t *)v->cell - 1 : NULL;
+  block = lval_mem_realloc(v, block, sizeof(size_t) + sizeof(lval *) * cap);
+  block[0] = cap;
+  v->cell = (lval **)(block + 1);
+}
+
+/* Give memory back lazily, once at most a quarter of it is in use */
+void lval_cells_shrink(lval *v) {
+  int cap = LVAL_CAPACITY(v);
+  if (LVAL_IS_YOUNG(v) || cap <= 16 || v->count > cap / 4) {
+    return;
+  }
+  cap /= 2;
+  size_t *block = realloc((size_t *)v->cell - 1,
+                          sizeof(size_t) + sizeof(lval *) * cap);
+  block[0] = cap;
+  v->cell = (lval **)(block + 1);
+}
+
+void lval_cells_free(lval *v) {
+  if (v->cell) {
+    lval_mem_free(v, (size_t *)v->cell - 1);
+  }
+}
+
+/*
+ * Taking the head or tail of a list, or any other run of its elements,
+ * gives a view: a Q-expression pointing straight into the cells of the
+ * original, which costs one node however long the list is. A view owns
+ * neither its cells nor their elements. Instead the list it was taken
+ * from is pinned by the line region until the line ends, or until the
+ * round of a tail call loop that took it is over, see lvm_eval. A view
+ * that outlives either is copied into a list of its own by lval_promote.
+ * Views are never mutated in place, lval_unshare copies them too.
+ * */
+
+/* Return a view of len elements of the list v starting at start,
+ * consuming v */
+lval *lval_slice(lval *v, int start, int len) {
+  /* A slice of a tree is another version of it, unless so little of the
+   * trie would still be in use that a fresh list is cheaper to keep */
+  if (v->tree) {
+    int unused = v->vec->start + v->count - len;
+    if (len < LVEC_MIN_SIZE || unused > len) {
+      return lvec_flatten(v, start, len);
+    }
+    v = lvec_unshare(v);
+    v->vec->start += start;
+    v->count = len;
+    return v;
+  }
+
+  /* An unshared view is just narrowed */
+  if (v->view && v->refcount == 1) {
+    v->cell += start;
+    v->count = len;
+    return v;
+  }
+
+  lval *x = lval_alloc();
+  x->type = LVAL_QEXPR;
+  x->view = 1;
+  x->cell = v->cell + start;
+  x->count = len;
+
+  /* A view of a view depends on the same pinned list */
+  if (v->view) {
+    lval_del(v);
+  } else {
+    lregion_pin(v);
+  }
+  return x;
+}
+
+/*
+ * Q-expressions that are stored with def and have at least LVEC_MIN_SIZE
+ * elements are kept as persistent vectors: a 32-way trie whose nodes are
+ * shared between every version. Taking the tail of a stored list or
+ * appending to it with join copies at most one path of the trie instead
+ * of the whole list, so each version costs O(log n). Everything stored in
+ * a trie has already been promoted, so tries never point into the
+ * nursery. Trees are never mutable in the lval_unshare sense, code that
+ * needs plain cells gets a flat copy.
+ * */
+
+/* Element i of any Q-expression or S-expression */
+lval *lval_index(lval *v, int i) {
+  if (!v->tree) {
+    return v->cell[i];
+  }
+  int p = v->vec->start + i;
+  lvnode *n = v->vec->root;
+  for (int s = v->vec->shift; s > 0; s -= LVEC_BITS) {
+    n = n->slot[(p >> s) & LVEC_MASK];
+  }
+  return n->slot[p & LVEC_MASK];
+}
+
+/* Return a node equal to n that only the caller refers to */
+lvnode *lvnode_own(lvnode *n, int shift) {
+  if (n && n->refcount == 1) {
+    return n;
+  }
+  lvnode *x = calloc(1, sizeof(lvnode));
+  x->refcount = 1;
+  if (!n) {
+    return x;
+  }
+
+  memcpy(x->slot, n->slot, sizeof(n->slot));
+  for (int k = 0; k < LVEC_WIDTH; k++) {
+    if (!x->slot[k]) {
+      continue;
+    }
+    if (shift > 0) {
+      ((lvnode *)x->slot[k])->refcount++;
+    } else {
+      lval_ref(x->slot[k]);
+    }
+  }
+  n->refcount--;
+  return x;
+}
+
+void lvnode_release(lvnode *n, int shift) {
+  if (!n || --n->refcount > 0) {
+    return;
+  }
+  for (int k = 0; k < LVEC_WIDTH; k++) {
+    if (!n->slot[k]) {
+      continue;
+    }
+    if (shift > 0) {
+      lvnode_release(n->slot[k], shift - LVEC_BITS);
+    } else if (!lgc.enabled) {
+      /* With the collector on, elements are swept on their own */
+      lval_del(n->slot[k]);
+    }
+  }
+  free(n);
+}
+
+/* The leaf for element i of the tree v, which must be the caller's own.
+ * Shared nodes on the way down are copied first, so the leaf can be
+ * written to. */
+lvnode *lvec_leaf(lval *v, int i) {
+  lvec *t = v->vec;
+  int p = t->start + i;
+
+  /* Add levels on top until p is in range */
+  while (p >> (t->shift + LVEC_BITS)) {
+    lvnode *root = calloc(1, sizeof(lvnode));
+    root->refcount = 1;
+    root->slot[0] = t->root;
+    t->root = root;
+    t->shift += LVEC_BITS;
+  }
+
+  lvnode **np = &t->root;
+  for (int s = t->shift; s > 0; s -= LVEC_BITS) {
+    *np = lvnode_own(*np, s);
+    np = (lvnode **)&(*np)->slot[(p >> s) & LVEC_MASK];
+  }
+  *np = lvnode_own(*np, 0);
+  return *np;
+}
+
+/* Store x as element i of the tree v, which must be the caller's own.
+ * x must be old. */
+void lvec_put(lval *v, int i, lval *x) {
+  void **slot = &lvec_leaf(v, i)->slot[(v->vec->start + i) & LVEC_MASK];
+  if (*slot) {
+    lval_del(*slot);
+  }
+  *slot = x;
+}
+
+/* Turn the empty node v into an empty tree */
+lval *lvec_build(lval *v) {
+  v->tree = 1;
+  v->vec = lval_mem_alloc(v, sizeof(lvec));
+  v->vec->root = lvnode_own(NULL, 0);
+  v->vec->shift = 0;
+  v->vec->start = 0;
+  return v;
+}
+
+/* Return a version of the tree v that the caller may change, consuming v.
+ * Only the version is new, the trie stays shared. */
+lval *lvec_unshare(lval *v) {
+  if (v->refcount == 1 && !v->compiled &&
+      (LVAL_IS_YOUNG(v) || lnursery.overflowed)) {
+    return v;
+  }
+  lval *x = lval_alloc();
+  x->type = v->type;
+  x->tree = 1;
+  x->count = v->count;
+  x->vec = lval_mem_alloc(x, sizeof(lvec));
+  *x->vec = *v->vec;
+  x->vec->root->refcount++;
+  lval_del(v);
+  return x;
+}
+
+/* Copy len elements of the tree v starting at start into a plain list,
+ * consuming v */
+lval *lvec_flatten(lval *v, int start, int len) {
+  lval *x = lval_qexpr();
+  lval_cells_reserve(x, len);
+  for (int i = 0; i < len; i++) {
+    x->cell[i] = lval_ref(lval_index(v, start + i));
+  }
+  x->count = len;
+  lval_del(v);
+  return x;
+}
+
+/*
+ * ################################
+ * #### GARBAGE COLLECTOR #########
+ * ################################
+ * */
+
+/*
+ * With --gc the interpreter stops freeing values when their reference
+ * count drops to zero. Instead a mark and sweep collector runs from
+ * lval_eval once enough nodes have been allocated, tracing from the
+ * environment and from the stack of expressions currently being
+ * evaluated. Reference counts are still kept so that lval_unshare knows
+ * when a value can be mutated in place; they can only overestimate.
+ * */
+
+void lgc_push(lval *v) {
+  if (lgc.nroots == lgc.rootcap) {
+    lgc.rootcap = lgc.rootcap ? lgc.rootcap * 2 : 64;
+    lgc.roots = realloc(lgc.roots, sizeof(lval *) * lgc.rootcap);
+  }
+  lgc.roots[lgc.nroots++] = v;
+}
+
+void lgc_pop(void) { lgc.nroots--; }
+
+/* Mark everything reachable from v, using an explicit stack so that
+ * deeply nested lists cannot overflow the C stack */
+void lgc_mark(lval *v) {
+  int n = 0;
+  if (LVAL_IS_FIXNUM(v) || v->mark) {
+    return;
+  }
+  v->mark = 1;
+  lgc.marks[n++] = v;
+
+  while (n > 0) {
+    lval *x = lgc.marks[--n];
+    lgc.live_bytes += sizeof(lval);
+
+    switch (x->type) {
+    case LVAL_ERR:
+      lgc.live_bytes += strlen(x->err) + 1;
+      break;
+    case LVAL_VEC:
+      lgc.live_bytes += sizeof(long) * x->count;
+      break;
+    case LVAL_BIG:
+      lgc.live_bytes += sizeof(uint32_t) * abs(x->count);
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      if (x->tree) {
+        lgc.live_bytes += sizeof(lvec);
+        n = lgc_mark_vec(x->vec->root, x->vec->shift, n);
+        break;
+      }
+      if (!x->view) {
+        lgc.live_bytes += sizeof(lval *) * x->count;
+      }
+      if (n + x->count > lgc.markcap) {
+        while (n + x->count > lgc.markcap) {
+          lgc.markcap *= 2;
+        }
+        lgc.marks = realloc(lgc.marks, sizeof(lval *) * lgc.markcap);
+      }
+      for (int i = 0; i < x->count; i++) {
+        lval *c = x->cell[i];
+        if (!LVAL_IS_FIXNUM(c) && !c->mark) {
+          c->mark = 1;
+          lgc.marks[n++] = c;
+        }
+      }
+      break;
+    }
+  }
+}
+
+/* Mark the trie under n, pushing its elements onto the mark stack from
+ * position sp. Nodes shared between versions are only visited once. */
+int lgc_mark_vec(lvnode *n, int shift, int sp) {
+  int epoch = (int)lgc.collections + 1;
+  if (n->mark == epoch) {
+    return sp;
+  }
+  n->mark = epoch;
+  lgc.live_bytes += sizeof(lvnode);
+
+  if (sp + LVEC_WIDTH > lgc.markcap) {
+    lgc.markcap *= 2;
+    lgc.marks = realloc(lgc.marks, sizeof(lval *) * lgc.markcap);
+  }
+  for (int k = 0; k < LVEC_WIDTH; k++) {
+    if (!n->slot[k]) {
+      continue;
+    }
+    if (shift > 0) {
+      sp = lgc_mark_vec(n->slot[k], shift - LVEC_BITS, sp);
+      continue;
+    }
+    lval *c = n->slot[k];
+    if (!LVAL_IS_FIXNUM(c) && !c->mark) {
+      c->mark = 1;
+      lgc.marks[sp++] = c;
+    }
+  }
+  return sp;
+}
+
+/* Free every node that was not marked and clear the marks of the rest */
+void lgc_sweep(void) {
+  for (lslab *s = lpool.slabs; s; s = s->next) {
+    for (int i = 0; i < LPOOL_SLAB_SIZE; i++) {
+      lval *v = &s->vals[i];
+      if (v->type == LVAL_FREE) {
+        continue;
+      }
+      if (v->mark) {
+        v->mark = 0;
+        lgc.live_nodes++;
+        continue;
+      }
+
+      /* Children are swept on their own, only release owned storage */
+      switch (v->type) {
+      case LVAL_ERR:
+        free(v->err);
+        break;
+      case LVAL_VEC:
+        free(v->ints);
+        break;
+      case LVAL_BIG:
+        free(v->limbs);
+        break;
+      case LVAL_SEXPR:
+      case LVAL_QEXPR:
+        if (v->tree) {
+          lvnode_release(v->vec->root, v->vec->shift);
+          free(v->vec);
+        } else if (!v->view) {
+          lval_cells_free(v);
+        }
+        break;
+      }
+      lval_free(v);
+    }
+  }
+}
+
+void lgc_collect(lenv *e) {
+  clock_t start = clock();
+
+  if (!lgc.marks) {
+    lgc.markcap = 1024;
+    lgc.marks = malloc(sizeof(lval *) * lgc.markcap);
+  }
+  lgc.live_nodes = 0;
+  lgc.live_bytes = 0;
+
+  /* Roots are the environment, the expressions being evaluated, the VM
+   * and tree walker stacks and the lists that views point into */
+  for (int i = 0; i < e->count; i++) {
+    if (e->order[i]->val) {
+      lgc_mark(e->order[i]->val);
+    }
+  }
+  for (int i = 0; i < lgc.nroots; i++) {
+    lgc_mark(lgc.roots[i]);
+  }
+  for (int i = 0; i < lregion.npins; i++) {
+    lgc_mark(lregion.pins[i]);
+  }
+  for (int i = 0; i < lvm.sp; i++) {
+    lgc_mark(lvm.stack[i]);
+  }
+  for (int i = 0; i < leval.count; i++) {
+    lgc_mark(leval.frames[i].v);
+  }
+  if (ltail.pending) {
+    lgc_mark(ltail.pending);
+  }
+  lgc_sweep();
+
+  /* Young nodes are not swept, but their marks must be cleared too */
+  for (lval *v = lnursery.start; v < lnursery.top; v++) {
+    v->mark = 0;
+  }
+
+  /* Let the heap grow to twice its live size before the next collection */
+  lgc.allocated = 0;
+  lgc.threshold = 2 * lgc.live_nodes;
+  if (lgc.threshold < LGC_MIN_THRESHOLD) {
+    lgc.threshold = LGC_MIN_THRESHOLD;
+  }
+
+  double pause = (double)(clock() - start) / CLOCKS_PER_SEC;
+  lgc.collections++;
+  lgc.last_pause = pause;
+  lgc.total_pause += pause;
+  if (pause > lgc.max_pause) {
+    lgc.max_pause = pause;
+  }
+}
+
+/*
+ * ################################
+ * #### LISP TYPES ################
+ * ################################
+ * */
+
+lval *lval_num(long x) {
+  /* Only numbers outside the fixnum range need a node */
+  if (x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX) {
+    return LVAL_FIXNUM(x);
+  }
+  lval *v = lval_alloc();
+  v->num = x;
+  v->type = LVAL_NUM;
+  return v;
+}
+
+lval *lval_err(char *fmt, ...) {
+  lval *v = lval_alloc();
+  v->type = LVAL_ERR;
+
+  /* Create a va list and initialize it */
+  va_list va;
+  va_start(va, fmt);
+
+  /* Allocate 512 bytes of space */
+  v->err = lval_mem_alloc(v, 512);
+
+  /* printf the error string with a max of 511 characters */
+  vsnprintf(v->err, 511, fmt, va);
+
+  /* Reallocate to number of bytes actually used */
+  v->err = lval_mem_realloc(v, v->err, strlen(v->err) + 1);
+
+  va_end(va);
+  return v;
+  ;
+}
+
+lval *lval_sym(char *s) {
+  lsymbol *sym = lsym_intern(s);
+  lval *v = lval_alloc();
+  v->type = LVAL_SYM;
+  v->sym = sym->name;
+  /* Symbols have no children, so count caches the hash of the name */
+  v->count = sym->hash;
+  return v;
+}
+
+lval *lval_sexpr(void) {
+  lval *v = lval_alloc();
+  v->type = LVAL_SEXPR;
+  v->count = 0;
+  v->cell = NULL;
+  return v;
+}
+
+lval *lval_qexpr(void) {
+  lval *v = lval_alloc();
+  v->type = LVAL_QEXPR;
+  v->count = 0;
+  v->cell = NULL;
+  return v;
+}
+
+lval *lval_fun(lbuiltin func) {
+  lval *v = lval_alloc();
+  v->type = LVAL_FUN;
+  v->fun = func;
+  return v;
+}
+
+/* A vector of n numbers, left for the caller to fill in */
+lval *lval_vec(int n) {
+  lval *v = lval_alloc();
+  v->type = LVAL_VEC;
+  v->count = n;
+  v->ints = lval_mem_alloc(v, sizeof(long) * (n ? n : 1));
+  return v;
+}
+
+lval *lval_read_num(mpc_ast_t *t) {
+  errno = 0;
+  long x = strtol(t->contents, NULL, 10);
+  return errno != ERANGE ? lval_num(x) : lbig_read(t->contents);
+}
+
+lval *lval_read(mpc_ast_t *t) {
+
+  /* If number or symbol, return conversion to that type */
+  if (strstr(t->tag, "number")) {
+    return lval_read_num(t);
+  }
+  if (strstr(t->tag, "symbol")) {
+    return lval_sym(t->contents);
+  }
+  /* If root (>) or sexpr then create empty list */
+  lval *x = NULL;
+  if (strcmp(t->tag, ">") == 0) {
+    x = lval_sexpr();
+  }
+  if (strstr(t->tag, "sexpr")) {
+    x = lval_sexpr();
+  }
+
+  if (strstr(t->tag, "qexpr")) {
+    x = lval_qexpr();
+  }
+
+  /* Fill the list with any valid expression contained within */
+  for (int i = 0; i < t->children_num; i++) {
+    if (strcmp(t->children[i]->contents, "(") == 0) {
+      continue;
+    }
+    if (strcmp(t->children[i]->contents, ")") == 0) {
+      continue;
+    }
+    if (strcmp(t->children[i]->contents, "{") == 0) {
+      continue;
+    }
+    if (strcmp(t->children[i]->contents, "}") == 0) {
+      continue;
+    }
+    if (strcmp(t->children[i]->tag, "regex") == 0) {
+      continue;
+    }
+    x = lval_add(x, lval_read(t->children[i]));
+  }
+
+  /* A lone top level expression is evaluated as itself, so that typing a
+   * function name prints it rather than calling it */
+  if (strcmp(t->tag, ">") == 0 && x->count == 1) {
+    return lval_take(x, 0);
+  }
+  return x;
+}
+
+lval *lval_add(lval *v, lval *x) {
+  lval_cells_reserve(v, v->count + 1);
+  v->cell[v->count++] = x;
+  return v;
+}
+
+void lval_del(lval *v) {
+  /* Fixnums own no memory */
+  if (LVAL_IS_FIXNUM(v)) {
+    return;
+  }
+
+  /* Only the last reference frees the value */
+  if (v->refcount == LVAL_REFCOUNT_MAX) {
+    return;
+  }
+  if (--v->refcount > 0) {
+    return;
+  }
+
+  /* The collector reclaims unreferenced values in its own time */
+  if (lgc.enabled) {
+    return;
+  }
+
+  switch (v->type) {
+  /* Do nothing special for number type of functions */
+  case LVAL_NUM:
+  case LVAL_FUN:
+    break;
+
+  /* For Err free the string data */
+  case LVAL_ERR:
+    lval_mem_free(v, v->err);
+    break;
+  case LVAL_SYM:
+    /* Symbol names belong to the intern table */
+    break;
+  case LVAL_VEC:
+    lval_mem_free(v, v->ints);
+    break;
+  case LVAL_BIG:
+    lval_mem_free(v, v->limbs);
+    break;
+
+  /* If Sexpr then delete all elements inside */
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    /* Unless it is a view, whose elements belong to a pinned list */
+    if (v->view) {
+      break;
+    }
+    if (v->tree) {
+      lvnode_release(v->vec->root, v->vec->shift);
+      lval_mem_free(v, v->vec);
+      break;
+    }
+    for (int i = 0; i < v->count; i++) {
+      lval_del(v->cell[i]);
+    }
+    /* Also free the memory allocated to contain the pointers */
+    lval_cells_free(v);
+    break;
+  }
+
+  /* Return the "lval" struct itself to the pool */
+  lval_free(v);
+}
+
+/*
+ * ################################
+ * #### BIGNUMS ###################
+ * ################################
+ * */
+
+/* The long x as a bignum, with its limbs in buf */
+void lbig_from_long(lbig *b, long x, uint32_t *buf) {
+  unsigned long m = x < 0 ? -(unsigned long)x : (unsigned long)x;
+  b->neg = x < 0;
+  b->d = buf;
+  b->n = 0;
+  while (m) {
+    buf[b->n++] = (uint32_t)m;
+    /* Two shifts, a long may be only 32 bits wide */
+    m = m >> 16 >> 16;
+  }
+}
+
+/* Look at the number v as a bignum, with buf holding a long's limbs */
+void lbig_view(lbig *b, lval *v, uint32_t *buf) {
+  if (LVAL_TYPE(v) == LVAL_NUM) {
+    lbig_from_long(b, LVAL_NUM_VALUE(v), buf);
+    return;
+  }
+  b->neg = v->count < 0;
+  b->n = b->neg ? -v->count : v->count;
+  b->d = v->limbs;
+}
+
+/* An owned copy of b */
+lbig lbig_dup(const lbig *b) {
+  lbig r = *b;
+  r.d = malloc(sizeof(uint32_t) * (b->n ? b->n : 1));
+  memcpy(r.d, b->d, sizeof(uint32_t) * b->n);
+  return r;
+}
+
+/* Drop leading zero limbs from the n limbs at d */
+int lbig_trim(const uint32_t *d, int n) {
+  while (n > 0 && d[n - 1] == 0) {
+    n--;
+  }
+  return n;
+}
+
+/* Compare magnitudes without leading zeros, giving -1, 0 or 1 */
+int lbig_cmp_mag(const uint32_t *a, int an, const uint32_t *b, int bn) {
+  if (an != bn) {
+    return an < bn ? -1 : 1;
+  }
+  for (int i = an - 1; i >= 0; i--) {
+    if (a[i] != b[i]) {
+      return a[i] < b[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+int lbig_cmp(const lbig *a, const lbig *b) {
+  if (a->neg != b->neg) {
+    return a->neg ? -1 : 1;
+  }
+  int c = lbig_cmp_mag(a->d, a->n, b->d, b->n);
+  return a->neg ? -c : c;
+}
+
+/* Add the an limbs at a into the rn limbs at r, rn >= an, returning the
+ * carry out of the top */
+uint32_t lbig_addto(uint32_t *r, int rn, const uint32_t *a, int an) {
+  uint64_t k = 0;
+  int i = 0;
+  for (; i < an; i++) {
+    k += (uint64_t)r[i] + a[i];
+    r[i] = (uint32_t)k;
+    k >>= 32;
+  }
+  for (; k && i < rn; i++) {
+    k += r[i];
+    r[i] = (uint32_t)k;
+    k >>= 32;
+  }
+  return (uint32_t)k;
+}
+
+/* Subtract the an limbs at a from the rn limbs at r, which must not be
+ * smaller */
+void lbig_subfrom(uint32_t *r, int rn, const uint32_t *a, int an) {
+  int64_t k = 0;
+  int i = 0;
+  for (; i < an; i++) {
+    k += (int64_t)r[i] - a[i];
+    r[i] = (uint32_t)k;
+    k = k < 0 ? -1 : 0;
+  }
+  for (; k && i < rn; i++) {
+    k += r[i];
+    r[i] = (uint32_t)k;
+    k = k < 0 ? -1 : 0;
+  }
+}
+
+/* a + b, or a - b if sub is set */
+lbig lbig_add(const lbig *a, const lbig *b, int sub) {
+  int bneg = b->neg ^ sub;
+  lbig r;
+  if (a->neg == bneg) {
+    const lbig *x = a->n >= b->n ? a : b;
+    const lbig *y = x == a ? b : a;
+    r.d = malloc(sizeof(uint32_t) * (x->n + 1));
+    memcpy(r.d, x->d, sizeof(uint32_t) * x->n);
+    r.d[x->n] = lbig_addto(r.d, x->n, y->d, y->n);
+    r.n = lbig_trim(r.d, x->n + 1);
+    r.neg = a->neg && r.n;
+    return r;
+  }
+  /* Opposite signs: take the smaller magnitude from the larger */
+  int c = lbig_cmp_mag(a->d, a->n, b->d, b->n);
+  const lbig *x = c >= 0 ? a : b;
+  const lbig *y = x == a ? b : a;
+  r.d = malloc(sizeof(uint32_t) * (x->n ? x->n : 1));
+  memcpy(r.d, x->d, sizeof(uint32_t) * x->n);
+  lbig_subfrom(r.d, x->n, y->d, y->n);
+  r.n = lbig_trim(r.d, x->n);
+  r.neg = (c >= 0 ? a->neg : bneg) && r.n;
+  return r;
+}
+
+/* The an + bn limbs of a * b into r, which must not overlap them. Large
+ * operands use Karatsuba's method, three half size products instead of
+ * four. */
+void lbig_mul_mag(uint32_t *r, const uint32_t *a, int an, const uint32_t *b,
+                  int bn) {
+  if (an < bn) {
+    const uint32_t *t = a;
+    a = b;
+    b = t;
+    int tn = an;
+    an = bn;
+    bn = tn;
+  }
+  memset(r, 0, sizeof(uint32_t) * (an + bn));
+  if (bn < LBIG_KARATSUBA) {
+    for (int i = 0; i < bn; i++) {
+      uint64_t k = 0;
+      for (int j = 0; j < an; j++) {
+        k += (uint64_t)b[i] * a[j] + r[i + j];
+        r[i + j] = (uint32_t)k;
+        k >>= 32;
+      }
+      r[i + an] = (uint32_t)k;
+    }
+    return;
+  }
+
+  /* Split a = a1 B^m + a0, and b likewise if it reaches past m */
+  int m = (an + 1) / 2;
+  if (bn <= m) {
+    uint32_t *t = malloc(sizeof(uint32_t) * (an - m + bn));
+    lbig_mul_mag(r, a, m, b, bn);
+    lbig_mul_mag(t, a + m, an - m, b, bn);
+    lbig_addto(r + m, an + bn - m, t, an - m + bn);
+    free(t);
+    return;
+  }
+  /* a0 b0 and a1 b1 go straight into place, then the middle term is
+   * (a0 + a1)(b0 + b1) - a0 b0 - a1 b1 */
+  int hn = an + bn - 2 * m;
+  uint32_t *sa = malloc(sizeof(uint32_t) * (4 * m + 4));
+  uint32_t *sb = sa + m + 1;
+  uint32_t *mid = sb + m + 1;
+  lbig_mul_mag(r, a, m, b, m);
+  lbig_mul_mag(r + 2 * m, a + m, an - m, b + m, bn - m);
+  memcpy(sa, a, sizeof(uint32_t) * m);
+  sa[m] = lbig_addto(sa, m, a + m, an - m);
+  memcpy(sb, b, sizeof(uint32_t) * m);
+  sb[m] = lbig_addto(sb, m, b + m, bn - m);
+  lbig_mul_mag(mid, sa, m + 1, sb, m + 1);
+  lbig_subfrom(mid, 2 * m + 2, r, 2 * m);
+  lbig_subfrom(mid, 2 * m + 2, r + 2 * m, hn);
+  /* The middle term fits in what is left of r, any limbs past it are 0 */
+  int mn = lbig_trim(mid, 2 * m + 2);
+  lbig_addto(r + m, an + bn - m, mid, mn);
+  free(sa);
+}
+
+lbig lbig_mul(const lbig *a, const lbig *b) {
+  lbig r;
+  r.d = malloc(sizeof(uint32_t) * (a->n + b->n + 1));
+  lbig_mul_mag(r.d, a->d, a->n, b->d, b->n);
+  r.n = lbig_trim(r.d, a->n + b->n);
+  r.neg = a->neg != b->neg && r.n;
+  return r;
+}
+
+/* The un - vn + 1 limbs of u / v into q, for vn > 0 and v without
+ * leading zeros. Knuth's algorithm D. */
+void lbig_div_mag(uint32_t *q, const uint32_t *u, int un, const uint32_t *v,
+                  int vn) {
+  if (vn == 1) {
+    uint64_t k = 0;
+    for (int j = un - 1; j >= 0; j--) {
+      k = k << 32 | u[j];
+      q[j] = (uint32_t)(k / v[0]);
+      k %= v[0];
+    }
+    return;
+  }
+
+  /* Shift the divisor left until its top bit is set, which keeps the
+   * estimated quotient digits at most two too large */
+  int s = 0;
+  while (!(v[vn - 1] << s & 0x80000000u)) {
+    s++;
+  }
+  uint32_t *nv = malloc(sizeof(uint32_t) * (vn + un + 1));
+  uint32_t *nu = nv + vn;
+  for (int i = vn - 1; i > 0; i--) {
+    nv[i] = v[i] << s | (uint32_t)((uint64_t)v[i - 1] >> (32 - s));
+  }
+  nv[0] = v[0] << s;
+  nu[un] = (uint32_t)((uint64_t)u[un - 1] >> (32 - s));
+  for (int i = un - 1; i > 0; i--) {
+    nu[i] = u[i] << s | (uint32_t)((uint64_t)u[i - 1] >> (32 - s));
+  }
+  nu[0] = u[0] << s;
+
+  for (int j = un - vn; j >= 0; j--) {
+    uint64_t top = (uint64_t)nu[j + vn] << 32 | nu[j + vn - 1];
+    uint64_t qhat = top / nv[vn - 1];
+    uint64_t rhat = top % nv[vn - 1];
+    while (qhat >> 32 ||
+           qhat * nv[vn - 2] > (rhat << 32 | nu[j + vn - 2])) {
+      qhat--;
+      rhat += nv[vn - 1];
+      if (rhat >> 32) {
+        break;
+      }
+    }
+    /* Multiply and subtract, adding back once if qhat was one too big */
+    int64_t k = 0;
+    int64_t t;
+    for (int i = 0; i < vn; i++) {
+      uint64_t p = qhat * nv[i];
+      t = (int64_t)nu[i + j] - k - (int64_t)(p & 0xFFFFFFFFu);
+      nu[i + j] = (uint32_t)t;
+      k = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)nu[j + vn] - k;
+    nu[j + vn] = (uint32_t)t;
+    q[j] = (uint32_t)qhat;
+    if (t < 0) {
+      q[j]--;
+      nu[j + vn] += lbig_addto(nu + j, vn, nv, vn);
+    }
+  }
+  free(nv);
+}
+
+/* a / b rounded towards zero like C, for b other than 0 */
+lbig lbig_div(const lbig *a, const lbig *b) {
+  lbig r;
+  if (lbig_cmp_mag(a->d, a->n, b->d, b->n) < 0) {
+    r.d = malloc(sizeof(uint32_t));
+    r.n = 0;
+    r.neg = 0;
+    return r;
+  }
+  r.d = malloc(sizeof(uint32_t) * (a->n - b->n + 1));
+  lbig_div_mag(r.d, a->d, a->n, b->d, b->n);
+  r.n = lbig_trim(r.d, a->n - b->n + 1);
+  r.neg = a->neg != b->neg && r.n;
+  return r;
+}
+
+/* The value of b, consuming it. Numbers that fit in a long are demoted,
+ * so a bignum is never equal to any long. */
+lval *lbig_lval(lbig *b) {
+  if (b->n <= LBIG_LONG_LIMBS) {
+    unsigned long m = 0;
+    for (int i = b->n - 1; i >= 0; i--) {
+      m = m << 16 << 16 | b->d[i];
+    }
+    if (b->n < LBIG_LONG_LIMBS || m <= (unsigned long)LONG_MAX + b->neg) {
+      free(b->d);
+      return lval_num(b->neg ? (long)(0 - m) : (long)m);
+    }
+  }
+  lval *v = lval_alloc();
+  v->type = LVAL_BIG;
+  v->count = b->neg ? -b->n : b->n;
+  v->limbs = lval_mem_alloc(v, sizeof(uint32_t) * b->n);
+  memcpy(v->limbs, b->d, sizeof(uint32_t) * b->n);
+  free(b->d);
+  return v;
+}
+
+/* Apply arithmetic operator op exactly, for calls the kernels could not
+ * finish: those with bignum operands, results that overflow a long and
+ * division by zero. a holds only numbers. */
+lval *lbig_arith(lval *a, int op) {
+  uint32_t xbuf[LBIG_LONG_LIMBS];
+  uint32_t ybuf[LBIG_LONG_LIMBS];
+  lbig x;
+  lbig y;
+  lbig_view(&x, a->cell[0], xbuf);
+  x = lbig_dup(&x);
+  /* A lone operand of - is negated */
+  if (a->count == 1 && op == 1) {
+    x.neg = !x.neg && x.n;
+  }
+
+  for (int i = 1; i < a->count; i++) {
+    lbig_view(&y, a->cell[i], ybuf);
+    lbig r;
+    switch (op) {
+    case 0:
+    case 1:
+      r = lbig_add(&x, &y, op);
+      break;
+    case 2:
+      r = lbig_mul(&x, &y);
+      break;
+    case 3:
+      if (y.n == 0) {
+        free(x.d);
+        lval_del(a);
+        return lval_err("Division by Zero");
+      }
+      r = lbig_div(&x, &y);
+      break;
+    default:
+      if ((lbig_cmp(&y, &x) < 0) != (op == 5)) {
+        r = lbig_dup(&y);
+        break;
+      }
+      continue;
+    }
+    free(x.d);
+    x = r;
+  }
+  lval_del(a);
+  return lbig_lval(&x);
+}
+
+/* Read a decimal bignum, nine digits at a time */
+lval *lbig_read(const char *s) {
+  lbig b;
+  b.neg = *s == '-';
+  s += b.neg;
+  int len = strlen(s);
+  b.d = malloc(sizeof(uint32_t) * (len / 9 + 1));
+  b.n = 0;
+  for (int i = 0, step = len % 9 ? len % 9 : 9; i < len; i += step, step = 9) {
+    uint64_t k = 0;
+    uint64_t scale = 1;
+    for (int j = 0; j < step; j++) {
+      k = k * 10 + (s[i + j] - '0');
+      scale *= 10;
+    }
+    for (int j = 0; j < b.n; j++) {
+      k += scale * b.d[j];
+      b.d[j] = (uint32_t)k;
+      k >>= 32;
+    }
+    if (k) {
+      b.d[b.n++] = (uint32_t)k;
+    }
+  }
+  return lbig_lval(&b);
+}
+
+/* Print a bignum in decimal, splitting off nine digits at a time */
+void lbig_print(lval *v) {
+  lbig b;
+  lbig_view(&b, v, NULL);
+  uint32_t *m = malloc(sizeof(uint32_t) * b.n * 3);
+  uint32_t *digits = m + b.n;
+  memcpy(m, b.d, sizeof(uint32_t) * b.n);
+  int n = b.n;
+  int count = 0;
+  while (n) {
+    uint64_t k = 0;
+    for (int j = n - 1; j >= 0; j--) {
+      k = k << 32 | m[j];
+      m[j] = (uint32_t)(k / 1000000000);
+      k %= 1000000000;
+    }
+    digits[count++] = (uint32_t)k;
+    n = lbig_trim(m, n);
+  }
+  printf("%s%lu", b.neg ? "-" : "", (unsigned long)digits[count - 1]);
+  for (int i = count - 2; i >= 0; i--) {
+    printf("%09lu", (unsigned long)digits[i]);
+  }
+  free(m);
+}
+
+/*
+ * ################################
+ * #### EVALUATION FUNCTION ##########
+ * ################################
+ * */
+
+/* Apply an S-expression whose children have all been evaluated */
+lval *lval_call(lenv *e, lval *v) {
+  /* Error checking in the childreb */
+  for (int i = 0; i < v->count; i++) {
+    if (LVAL_TYPE(v->cell[i]) == LVAL_ERR) {
+      return lval_take(v, i);
+    }
+  }
+
+  /* Empty Expression */
+  if (v->count == 0) {
+    return v;
+  }
+
+  /* Single Expression, unless it is a function called with no arguments */
+  if (v->count == 1 && LVAL_TYPE(v->cell[0]) != LVAL_FUN) {
+    return lval_take(v, 0);
+  }
+
+  /* If all of above is not matched, then it has to be starting with a symbol */
+
+  lval *f = lval_pop(v, 0);
+  if (LVAL_TYPE(f) != LVAL_FUN) {
+    lval_del(f);
+    lval_del(v); // Throw error
+    return lval_err("first element is not a function");
+  }
+
+  /* Call Function to get result. f is released first, since nothing
+   * keeps it alive for the collector during the call */
+  lbuiltin fun = f->fun;
+  lval_del(f);
+  return fun(e, v);
+}
+
+/*
+ * The tree walker keeps its own stack of partly evaluated S-expressions
+ * instead of recursing, so nesting depth is limited by memory rather
+ * than the C stack. Children are evaluated left to right and replaced
+ * by their values, then the S-expression is applied with lval_call.
+ * Only builtins that evaluate code, like eval, start a nested walk, and
+ * not even they do when called last, see lvm_eval.
+ * */
+lval *lval_eval(lenv *e, lval *v) {
+  v = lval_walk(e, v);
+  if (v == LVAL_TAIL) {
+    v = ltail.pending;
+    ltail.pending = NULL;
+    return lvm_eval(e, v);
+  }
+  return v;
+}
+
+/* Walk v, returning LVAL_TAIL if it ends in a tail call */
+lval *lval_walk(lenv *e, lval *v) {
+  int base = leval.count;
+  while (1) {
+    /* Entering an evaluation is a safe point for the collector */
+    if (lgc.enabled && lgc.allocated > lgc.threshold) {
+      lgc_push(v);
+      lgc_collect(e);
+      lgc_pop();
+    }
+
+    /* Descend into S-expressions until v is a value */
+    if (LVAL_TYPE(v) == LVAL_SYM) {
+      lval *x = lenv_get(e, v);
+      lval_del(v);
+      v = x;
+    } else if (LVAL_TYPE(v) == LVAL_SEXPR) {
+      /* Children are replaced by their values, so v must be our own */
+      v = lval_unshare(v);
+      if (v->count > 0) {
+        if (leval.count == leval.capacity) {
+          leval.capacity = leval.capacity ? leval.capacity * 2 : 64;
+          leval.frames =
+              realloc(leval.frames, sizeof(struct leframe) * leval.capacity);
+        }
+        leval.frames[leval.count].v = v;
+        leval.frames[leval.count++].i = 0;
+        v = v->cell[0];
+        continue;
+      }
+      v = lval_call(e, v);
+    }
+
+    /* Then hand values back up, applying every S-expression whose
+     * children are all done. The stack may move during a call. */
+    while (leval.count > base) {
+      struct leframe *f = &leval.frames[leval.count - 1];
+      f->v->cell[f->i++] = v;
+      if (f->i < f->v->count) {
+        break;
+      }
+      lval *x = f->v;
+      leval.count--;
+      ltail.ok = leval.count == base;
+      v = lval_call(e, x);
+      ltail.ok = 0;
+    }
+    if (leval.count == base) {
+      return v;
+    }
+    struct leframe *f = &leval.frames[leval.count - 1];
+    v = f->v->cell[f->i];
+  }
+}
+
+/*
+ * ################################
+ * #### BYTECODE VM ###############
+ * ################################
+ * */
+
+/*
+ * Every stored Q-expression that is passed to eval gets a code unit that
+ * counts its evaluations. The first runs walk the tree like any other
+ * code. After LVM_THRESHOLD evaluations the expression is compiled into
+ * bytecode for a small stack machine, and after LJIT_THRESHOLD into
+ * native code where that is possible, see ljit_compile. Evaluation order
+ * and results are exactly those of lval_eval, since both end in
+ * lval_call, but the VM skips copying the shared expression, walking it,
+ * and dispatching on the type of every node again. Code units are
+ * cached by the address of the expression and dropped by lval_free.
+ * Compiled expressions are never mutated in place.
+ * */
+
+/* Compiled code, open addressing on the expression address */
+static struct {
+  int count;
+  int nslots;
+  lcode **slots;
+} lcodetab;
+
+static unsigned int lcode_hash(lval *v) {
+  return (unsigned int)(((uintptr_t)v >> 4) * 2654435761u);
+}
+
+/* Only stored code is worth a code unit, young expressions die with the
+ * line. Units are kept with the VM off too, to count their evaluations. */
+int lvm_eligible(lval *v) {
+  return !LVAL_IS_YOUNG(v) && !v->view;
+}
+
+static const char *const ltier_names[] = {"tree", "vm", "jit"};
+
+/* Time per tier is sampled rather than measured, so that hot code only
+ * pays for noting where it runs. Each tick of a CPU time timer charges
+ * the time since the last one to whatever is running. */
+void ltier_init(void) {
+#ifndef _WIN32
+  ltier_tick(0);
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = ltier_tick;
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGVTALRM, &sa, NULL);
+  struct itimerval it = {{0, LTIER_TICK_US}, {0, LTIER_TICK_US}};
+  setitimer(ITIMER_VIRTUAL, &it, NULL);
+#endif
+}
+
+void ltier_tick(int sig) {
+#ifndef _WIN32
+  struct timespec t;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+  long now = t.tv_sec * 1000000000L + t.tv_nsec;
+  if (ltier.current >= 0) {
+    ltier.time[ltier.current] += now - ltier.last;
+    if (ltier.unit) {
+      ltier.unit->time += now - ltier.last;
+    }
+  }
+  ltier.last = now;
+#endif
+}
+
+/* Return the code unit of v, or NULL if it has none yet */
+lcode *lcode_find(lval *v) {
+  if (!v->compiled) {
+    return NULL;
+  }
+  unsigned int mask = lcodetab.nslots - 1;
+  unsigned int i = lcode_hash(v) & mask;
+  while (lcodetab.slots[i]->src != v) {
+    i = (i + 1) & mask;
+  }
+  return lcodetab.slots[i];
+}
+
+/* Return the code unit of v, creating it on first use */
+lcode *lcode_get(lval *v) {
+  lcode *c = lcode_find(v);
+  if (c) {
+    return c;
+  }
+
+  c = calloc(1, sizeof(lcode));
+  c->src = v;
+  v->compiled = 1;
+
+  unsigned int mask = lcodetab.nslots - 1;
+  if (lcodetab.count * 2 >= lcodetab.nslots) {
+    /* Double the table and reinsert all code */
+    int nslots = lcodetab.nslots ? lcodetab.nslots * 2 : 64;
+    lcode **slots = calloc(nslots, sizeof(lcode *));
+    for (int i = 0; i < lcodetab.nslots; i++) {
+      lcode *old = lcodetab.slots[i];
+      if (old) {
+        unsigned int j = lcode_hash(old->src) & (nslots - 1);
+        while (slots[j]) {
+          j = (j + 1) & (nslots - 1);
+        }
+        slots[j] = old;
+      }
+    }
+    free(lcodetab.slots);
+    lcodetab.slots = slots;
+    lcodetab.nslots = nslots;
+    mask = nslots - 1;
+  }
+  unsigned int i = lcode_hash(v) & mask;
+  while (lcodetab.slots[i]) {
+    i = (i + 1) & mask;
+  }
+  lcodetab.slots[i] = c;
+  lcodetab.count++;
+  return c;
+}
+
+/* Drop the code for v, which is being freed */
+void lcode_forget(lval *v) {
+  unsigned int mask = lcodetab.nslots - 1;
+  unsigned int i = lcode_hash(v) & mask;
+  while (lcodetab.slots[i]->src != v) {
+    i = (i + 1) & mask;
+  }
+  lcode *c = lcodetab.slots[i];
+  if (ltier.unit == c) {
+    ltier.unit = NULL;
+  }
+  if (c->jit) {
+    ljit_free(c->jit);
+  }
+  free(c->ins);
+  free(c->consts);
+  free(c->globals);
+  free(c);
+
+  /* Shift later entries of the probe sequence back into the hole */
+  unsigned int j = i;
+  while (1) {
+    lcodetab.slots[i] = NULL;
+    do {
+      j = (j + 1) & mask;
+      if (!lcodetab.slots[j]) {
+        lcodetab.count--;
+        v->compiled = 0;
+        return;
+      }
+    } while (((j - (lcode_hash(lcodetab.slots[j]->src) & mask)) & mask) <
+             ((j - i) & mask));
+    lcodetab.slots[i] = lcodetab.slots[j];
+    i = j;
+  }
+}
+
+/* Compile the code unit c to bytecode, against the environment e */
+void lcode_build(lcode *c, lenv *e) {
+  c->maxstack = lcode_compile(c, e, c->src, 0);
+  lcode_emit(c, LOP_RET, 0);
+}
+
+void lcode_emit(lcode *c, int op, int arg) {
+  if (c->count == c->capacity) {
+    c->capacity = c->capacity ? c->capacity * 2 : 16;
+    c->ins = realloc(c->ins, sizeof(int) * c->capacity);
+  }
+  c->ins[c->count++] = LOP(op, arg);
+}
+
+int lcode_const(lcode *c, lval *v) {
+  if (c->nconsts == c->constcap) {
+    c->constcap = c->constcap ? c->constcap * 2 : 16;
+    c->consts = realloc(c->consts, sizeof(lval *) * c->constcap);
+  }
+  c->consts[c->nconsts] = v;
+  return c->nconsts++;
+}
+
+/* Return the index of the binding of sym in c, adding it if needed */
+int lcode_global(lcode *c, lenv *e, lval *sym) {
+  lbinding *b = lenv_binding(e, sym);
+  for (int i = 0; i < c->nglobals; i++) {
+    if (c->globals[i] == b) {
+      return i;
+    }
+  }
+  if (c->nglobals == c->globalcap) {
+    c->globalcap = c->globalcap ? c->globalcap * 2 : 8;
+    c->globals = realloc(c->globals, sizeof(lbinding *) * c->globalcap);
+  }
+  c->globals[c->nglobals] = b;
+  return c->nglobals++;
+}
+
+/* Emit code that evaluates the children of v as an S-expression, with
+ * depth values already on the stack. Returns the most values the stack
+ * ever holds. */
+int lcode_compile(lcode *c, lenv *e, lval *v, int depth) {
+  int max = depth + 1;
+  for (int i = 0; i < v->count; i++) {
+    lval *x = lval_index(v, i);
+    int d = depth + i + 1;
+    switch (LVAL_TYPE(x)) {
+    case LVAL_SYM:
+      lcode_emit(c, LOP_LOAD, lcode_global(c, e, x));
+      break;
+    case LVAL_SEXPR:
+      d = lcode_compile(c, e, x, depth + i);
+      break;
+    case LVAL_NUM:
+      /* A constant last operand of a binary arithmetic call folds into
+       * the call */
+      if (i == 2 && v->count == 3 && lvm_arith_op(v) >= 0) {
+        int k = lcode_const(c, x);
+        lcode_emit(c, LOP_ARITHK, LOP_ARITH_ARG(k, lvm_arith_op(v)));
+        return max > d ? max : d;
+      }
+      lcode_emit(c, LOP_CONST, lcode_const(c, x));
+      break;
+    default:
+      lcode_emit(c, LOP_CONST, lcode_const(c, x));
+      break;
+    }
+    if (d > max) {
+      max = d;
+    }
+  }
+  if (v->count > 1 && lvm_arith_op(v) >= 0) {
+    lcode_emit(c, LOP_ARITH, LOP_ARITH_ARG(v->count - 1, lvm_arith_op(v)));
+  } else {
+    lcode_emit(c, LOP_CALL, v->count);
+  }
+  return max;
+}
+
+/* Builtins the VM can apply to two fixnums itself, in the order of the
+ * operator symbols */
+static const char lvm_arith_syms[] = "+-*/";
+static lbuiltin const lvm_arith_funs[] = {builtin_add, builtin_sub, builtin_mul,
+                                          builtin_div};
+
+/* Kernels of the arithmetic builtins, the first four in the same order */
+static char *const larith_names[] = {"+", "-", "*", "/", "min", "max"};
+static lkernel const larith_kernels[] = {lkernel_add, lkernel_sub,
+                                         lkernel_mul, lkernel_div,
+                                         lkernel_min, lkernel_max};
+
+/* Builtins that vmap, vfilter and vreduce run as element operators, see
+ * lkernel_elem: the arithmetic ones in the same order, then from
+ * LELEM_CMP on the comparisons */
+#define LELEM_CMP 6
+static lbuiltin const lelem_funs[] = {
+    builtin_add, builtin_sub, builtin_mul, builtin_div,
+    builtin_min, builtin_max, builtin_lt,  builtin_gt,
+    builtin_le,  builtin_ge,  builtin_eq,  builtin_ne};
+
+/* Return the index of the arithmetic operator that v starts with, or -1 */
+int lvm_arith_op(lval *v) {
+  lval *x = lval_index(v, 0);
+  if (LVAL_TYPE(x) != LVAL_SYM || x->sym[0] == '\0' || x->sym[1] != '\0') {
+    return -1;
+  }
+  char *op = strchr(lvm_arith_syms, x->sym[0]);
+  return op ? (int)(op - lvm_arith_syms) : -1;
+}
+
+/* Evaluate the Q-expression v as an S-expression in the highest tier its
+ * code unit has reached, consuming v. A tail call to eval replaces v and
+ * goes round again, so chains of evals run in constant stack and memory. */
+lval *lvm_eval(lenv *e, lval *v) {
+  lval *x = LVAL_TAIL;
+  while (x == LVAL_TAIL) {
+    lmark mark = lregion_mark();
+    lcode *c = NULL;
+    int tier = LTIER_TREE;
+    if (lvm_eligible(v)) {
+      c = lcode_get(v);
+      c->hits++;
+      if (c->hits == LVM_THRESHOLD && lvm.enabled) {
+        lcode_build(c, e);
+        c->tier = LTIER_VM;
+      }
+      if (c->hits == LJIT_THRESHOLD && lvm.enabled && lvm.jit) {
+        c->jit = ljit_compile(c);
+        c->tier = c->jit ? LTIER_JIT : c->tier;
+      }
+      tier = c->tier;
+    }
+
+    int outer = ltier.current;
+    lcode *outer_unit = ltier.unit;
+    ltier.current = tier;
+    ltier.unit = c;
+
+    long r;
+    if (tier == LTIER_JIT && ljit_run(e, c->jit, &r)) {
+      x = lval_num(r);
+    } else if (tier == LTIER_TREE) {
+      /* Stored code stays referenced, and so does its code unit, while
+       * young code is evaluated in place. The collector ignores
+       * references, so stored code is also a root in case it drops its
+       * own binding. */
+      x = lval_unshare(c ? lval_ref(v) : v);
+      v = c ? v : NULL;
+      x->type = LVAL_SEXPR;
+      if (v) {
+        lgc_push(v);
+      }
+      x = lval_walk(e, x);
+      if (v) {
+        lgc_pop();
+      }
+    } else {
+      /* Native code that cannot finish falls back to the bytecode */
+      tier = LTIER_VM;
+      ltier.current = tier;
+      /* The code borrows from v, so keep it alive and visible meanwhile */
+      lgc_push(v);
+      x = lvm_run(e, c);
+      lgc_pop();
+    }
+    if (v) {
+      lval_del(v);
+    }
+
+    ltier.evals[tier]++;
+    ltier.current = outer;
+    ltier.unit = outer_unit;
+
+    v = ltail.pending;
+    ltail.pending = NULL;
+    if (x == LVAL_TAIL) {
+      /* Only the next code is left of this round. Once it is promoted,
+       * the pins, young nodes and region memory of the round can go
+       * too, so an endless loop runs in constant memory and keeps
+       * allocating from the nursery. */
+      lval *next = lval_promote(v);
+      lval_del(v);
+      v = next;
+      lregion_release(&mark);
+    }
+  }
+  return x;
+}
+
+/* Next instruction, threaded straight to its handler when possible */
+#ifdef LVM_THREADED
+#define LVM_CASE(op) L_##op:
+#define LVM_NEXT()                                                             \
+  arg = *++ip >> 8;                                                            \
+  goto *labels[*ip & 0xFF]
+#else
+#define LVM_CASE(op) case op:
+#define LVM_NEXT()                                                             \
+  ip++;                                                                        \
+  continue
+#endif
+
+lval *lvm_run(lenv *e, lcode *c) {
+#ifdef LVM_THREADED
+  static void *const labels[] = {&&L_LOP_CONST, &&L_LOP_LOAD,
+                                 &&L_LOP_CALL,  &&L_LOP_ARITH,
+                                 &&L_LOP_ARITHK, &&L_LOP_RET};
+#endif
+  if (lvm.sp + c->maxstack > lvm.cap) {
+    while (lvm.sp + c->maxstack > lvm.cap) {
+      lvm.cap = lvm.cap ? lvm.cap * 2 : 256;
+    }
+    lvm.stack = realloc(lvm.stack, sizeof(lval *) * lvm.cap);
+  }
+
+  int *ip = c->ins;
+  int arg, n;
+  lval *f, *x;
+  long r;
+#ifdef LVM_THREADED
+  arg = *ip >> 8;
+  goto *labels[*ip & 0xFF];
+#else
+  for (;;) {
+    arg = *ip >> 8;
+    switch (*ip & 0xFF) {
+#endif
+
+  LVM_CASE(LOP_CONST)
+  lvm.stack[lvm.sp++] = lval_ref(c->consts[arg]);
+  LVM_NEXT();
+
+  LVM_CASE(LOP_LOAD)
+  f = c->globals[arg]->val;
+  lvm.stack[lvm.sp++] =
+      f ? lval_ref(f)
+        : lval_err("unbound symbol '%s'", c->globals[arg]->sym);
+  LVM_NEXT();
+
+  LVM_CASE(LOP_CALL)
+  x = lvm_call(e, arg, (ip[1] & 0xFF) == LOP_RET);
+  lvm.stack[lvm.sp++] = x;
+  LVM_NEXT();
+
+  LVM_CASE(LOP_ARITHK)
+  lvm.stack[lvm.sp++] = lval_ref(c->consts[arg >> 2]);
+  arg = LOP_ARITH_ARG(2, arg & 3);
+  /* fall through */
+
+  LVM_CASE(LOP_ARITH)
+  /* The operator still bound to its builtin and fixnum operands need no
+   * argument list, anything else is an ordinary call */
+  n = arg >> 2;
+  f = lvm.stack[lvm.sp - n - 1];
+  if (LVAL_TYPE(f) == LVAL_FUN && f->fun == lvm_arith_funs[arg & 3] &&
+      lvm_arith(arg & 3, &lvm.stack[lvm.sp - n], n, &r)) {
+    lvm.sp -= n + 1;
+    lval_del(f);
+    lvm.stack[lvm.sp++] = lval_num(r);
+    LVM_NEXT();
+  }
+  x = lvm_call(e, n + 1, (ip[1] & 0xFF) == LOP_RET);
+  lvm.stack[lvm.sp++] = x;
+  LVM_NEXT();
+
+  LVM_CASE(LOP_RET)
+  return lvm.stack[--lvm.sp];
+
+#ifndef LVM_THREADED
+    }
+  }
+#endif
+}
+
+/* Apply operator op to the n numbers in v like builtin_op, returning 0
+ * if they are not all fixnums or longs or the kernel cannot finish */
+int lvm_arith(int op, lval **v, int n, long *out) {
+  for (int i = 0; i < n; i++) {
+    if (LVAL_TYPE(v[i]) != LVAL_NUM) {
+      return 0;
+    }
+  }
+  return larith_kernels[op](v, n, out);
+}
+
+/* Pop n values off the stack and evaluate them as an S-expression, as a
+ * tail call if tail is set */
+lval *lvm_call(lenv *e, int n, int tail) {
+  /* A call is a safe point for the collector, like entering lval_eval */
+  if (lgc.enabled && lgc.allocated > lgc.threshold) {
+    lgc_collect(e);
+  }
+  lvm.sp -= n;
+  lval **v = &lvm.stack[lvm.sp];
+
+  /* A builtin applied to operands without errors is called straight
+   * away, anything else is left to lval_call */
+  int call = n > 0 && LVAL_TYPE(v[0]) == LVAL_FUN;
+  for (int i = 1; call && i < n; i++) {
+    call = LVAL_TYPE(v[i]) != LVAL_ERR;
+  }
+  lval *a = lval_sexpr();
+  lval_cells_reserve(a, n);
+  lval *x;
+  ltail.ok = tail;
+  if (call) {
+    lbuiltin fun = v[0]->fun;
+    lval_del(v[0]);
+    memcpy(a->cell, v + 1, sizeof(lval *) * (n - 1));
+    a->count = n - 1;
+    x = fun(e, a);
+  } else {
+    if (n > 0) {
+      memcpy(a->cell, v, sizeof(lval *) * n);
+    }
+    a->count = n;
+    x = lval_call(e, a);
+  }
+  ltail.ok = 0;
+  return x;
+}
+
+/*
+ * ################################
+ * #### JIT #######################
+ * ################################
+ * */
+
+/*
+ * Code units made only of numbers, symbols and binary arithmetic, the
+ * bulk of numeric scripts, are translated to x86-64 once they have been
+ * evaluated LJIT_THRESHOLD times. The native code keeps the operand
+ * stack on the machine stack. Before running it, ljit_run looks up every
+ * symbol and checks that operators are still bound to their builtins and
+ * operands to numbers. The code itself bails out on division by zero or
+ * overflow. Since such code has no side effects, a bail out simply runs
+ * the bytecode instead, which then reports the error or moves on to a
+ * bignum.
+ * */
+
+#ifdef LJIT
+
+/* Growable buffer that code is emitted into before it is mapped */
+typedef struct ljitbuf {
+  unsigned char *b;
+  int count;
+  int capacity;
+} ljitbuf;
+
+static void ljit_emit(ljitbuf *buf, const void *bytes, int n) {
+  while (buf->count + n > buf->capacity) {
+    buf->capacity = buf->capacity ? buf->capacity * 2 : 256;
+    buf->b = realloc(buf->b, buf->capacity);
+  }
+  memcpy(buf->b + buf->count, bytes, n);
+  buf->count += n;
+}
+
+/* Emit a jump with opcode bytes op to the bail out, patched later */
+static void ljit_bail(ljitbuf *buf, ljitbuf *fixups, const char *op, int n) {
+  ljit_emit(buf, op, n);
+  ljit_emit(fixups, &buf->count, sizeof(int));
+  ljit_emit(buf, "\0\0\0\0", 4);
+}
+
+/* Apply operator op to rax and rcx, leaving the result in rax */
+static void ljit_op(ljitbuf *buf, ljitbuf *fixups, int op) {
+  switch (op) {
+  case 0:
+    ljit_emit(buf, "\x48\x01\xC8", 3); /* add rax, rcx */
+    ljit_bail(buf, fixups, "\x0F\x80", 2); /* jo */
+    break;
+  case 1:
+    ljit_emit(buf, "\x48\x29\xC8", 3); /* sub rax, rcx */
+    ljit_bail(buf, fixups, "\x0F\x80", 2); /* jo */
+    break;
+  case 2:
+    ljit_emit(buf, "\x48\x0F\xAF\xC1", 4); /* imul rax, rcx */
+    ljit_bail(buf, fixups, "\x0F\x80", 2); /* jo */
+    break;
+  default:
+    ljit_emit(buf, "\x48\x85\xC9", 3); /* test rcx, rcx */
+    ljit_bail(buf, fixups, "\x0F\x84", 2); /* jz */
+    ljit_emit(buf, "\x48\x83\xF9\xFF", 4); /* cmp rcx, -1 */
+    ljit_bail(buf, fixups, "\x0F\x84", 2); /* je */
+    ljit_emit(buf, "\x48\x99\x48\xF7\xF9", 5); /* cqo; idiv rcx */
+    break;
+  }
+}
+
+/* Replace the top n values on the stack by operator op applied to them */
+static void ljit_arith(ljitbuf *buf, ljitbuf *fixups, int op, int n) {
+  int disp = (n - 1) * 8;
+  ljit_emit(buf, "\x48\x8B\x84\x24", 4); /* mov rax, [rsp + disp] */
+  ljit_emit(buf, &disp, 4);
+  if (n == 1 && op == 1) {
+    ljit_emit(buf, "\x48\xF7\xD8", 3); /* neg rax */
+    ljit_bail(buf, fixups, "\x0F\x80", 2); /* jo */
+  }
+  for (int i = 1; i < n; i++) {
+    disp = (n - 1 - i) * 8;
+    ljit_emit(buf, "\x48\x8B\x8C\x24", 4); /* mov rcx, [rsp + disp] */
+    ljit_emit(buf, &disp, 4);
+    ljit_op(buf, fixups, op);
+  }
+  disp = n * 8;
+  ljit_emit(buf, "\x48\x81\xC4", 3); /* add rsp, disp; push rax */
+  ljit_emit(buf, &disp, 4);
+  ljit_emit(buf, "\x50", 1);
+}
+
+/* Translate the code unit c, or return NULL if it does more than
+ * arithmetic */
+ljit *ljit_compile(lcode *c) {
+  /* First find which loads are operators, by tracking which instruction
+   * pushed each stack entry */
+  int *stack = malloc(sizeof(int) * (c->maxstack + 1));
+  int *ops = malloc(sizeof(int) * c->count);
+  int sp = 0;
+  int ok = 1;
+  for (int i = 0; ok && i < c->count; i++) {
+    int arg = c->ins[i] >> 8;
+    int n = 2;
+    ops[i] = -1;
+    switch (c->ins[i] & 0xFF) {
+    case LOP_CONST:
+      ok = LVAL_TYPE(c->consts[arg]) == LVAL_NUM;
+      stack[sp++] = -1;
+      break;
+    case LOP_LOAD:
+      stack[sp++] = i;
+      break;
+    case LOP_ARITHK:
+      ok = LVAL_TYPE(c->consts[arg >> 2]) == LVAL_NUM;
+      stack[sp++] = -1;
+      /* fall through */
+    case LOP_ARITH:
+      if ((c->ins[i] & 0xFF) == LOP_ARITH) {
+        n = arg >> 2;
+      }
+      ok = ok && stack[sp - n - 1] >= 0;
+      if (ok) {
+        ops[stack[sp - n - 1]] = arg & 3;
+      }
+      sp -= n;
+      stack[sp - 1] = -1;
+      break;
+    case LOP_RET:
+      break;
+    default:
+      ok = 0;
+      break;
+    }
+  }
+  free(stack);
+
+  /* Each binding is read once per run, and must be either always an
+   * operator or always an operand */
+  ljit *j = calloc(1, sizeof(ljit));
+  j->binds = malloc(sizeof(lbinding *) * c->count);
+  j->ops = malloc(sizeof(int) * c->count);
+  int *slot = malloc(sizeof(int) * c->count);
+  for (int i = 0; ok && i < c->count; i++) {
+    if ((c->ins[i] & 0xFF) != LOP_LOAD) {
+      continue;
+    }
+    lbinding *b = c->globals[c->ins[i] >> 8];
+    int d = 0;
+    while (d < j->nbinds && j->binds[d] != b) {
+      d++;
+    }
+    if (d == j->nbinds) {
+      j->binds[j->nbinds] = b;
+      j->ops[j->nbinds++] = ops[i];
+    }
+    ok = j->ops[d] == ops[i];
+    slot[i] = d;
+  }
+  if (!ok) {
+    free(ops);
+    free(slot);
+    ljit_free(j);
+    return NULL;
+  }
+
+  ljitbuf buf = {0};
+  ljitbuf fixups = {0};
+
+  /* push rbx; mov rbx, rsp, so that a bail out can drop the stack */
+  ljit_emit(&buf, "\x53\x48\x89\xE3", 4);
+  for (int i = 0; i < c->count; i++) {
+    int arg = c->ins[i] >> 8;
+    long x;
+    int disp;
+    switch (c->ins[i] & 0xFF) {
+    case LOP_CONST:
+      x = LVAL_NUM_VALUE(c->consts[arg]);
+      ljit_emit(&buf, "\x48\xB8", 2); /* mov rax, x; push rax */
+      ljit_emit(&buf, &x, 8);
+      ljit_emit(&buf, "\x50", 1);
+      break;
+    case LOP_LOAD:
+      /* Operators are checked by ljit_run and never pushed */
+      if (ops[i] < 0) {
+        disp = slot[i] * 8;
+        ljit_emit(&buf, "\xFF\xB7", 2); /* push qword [rdi + disp] */
+        ljit_emit(&buf, &disp, 4);
+      }
+      break;
+    case LOP_ARITH:
+      ljit_arith(&buf, &fixups, arg & 3, arg >> 2);
+      break;
+    case LOP_ARITHK:
+      x = LVAL_NUM_VALUE(c->consts[arg >> 2]);
+      ljit_emit(&buf, "\x48\xB9", 2); /* mov rcx, x; pop rax */
+      ljit_emit(&buf, &x, 8);
+      ljit_emit(&buf, "\x58", 1);
+      ljit_op(&buf, &fixups, arg & 3);
+      ljit_emit(&buf, "\x50", 1); /* push rax */
+      break;
+    case LOP_RET:
+      /* pop rax; mov [rsi], rax; mov rsp, rbx; pop rbx; mov eax, 1; ret */
+      ljit_emit(&buf, "\x58\x48\x89\x06\x48\x89\xDC\x5B\xB8\x01\0\0\0\xC3",
+                14);
+      break;
+    }
+  }
+  free(ops);
+  free(slot);
+
+  /* mov rsp, rbx; pop rbx; xor eax, eax; ret */
+  int bail = buf.count;
+  ljit_emit(&buf, "\x48\x89\xDC\x5B\x31\xC0\xC3", 7);
+  for (int i = 0; i < fixups.count; i += sizeof(int)) {
+    int at;
+    memcpy(&at, fixups.b + i, sizeof(int));
+    int rel = bail - (at + 4);
+    memcpy(buf.b + at, &rel, 4);
+  }
+  free(fixups.b);
+
+  /* Map the code writable, then flip it to executable */
+  void *mem = mmap(NULL, buf.count, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    free(buf.b);
+    ljit_free(j);
+    return NULL;
+  }
+  memcpy(mem, buf.b, buf.count);
+  /* A W^X policy may refuse, and the unit stays on the bytecode then */
+  if (mprotect(mem, buf.count, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, buf.count);
+    free(buf.b);
+    ljit_free(j);
+    return NULL;
+  }
+  j->size = buf.count;
+  *(void **)&j->fn = mem;
+  free(buf.b);
+  return j;
+}
+
+/* Run the native code of j, returning 0 if the bytecode must run instead */
+int ljit_run(lenv *e, ljit *j, long *out) {
+  long args[j->nbinds + 1];
+  for (int i = 0; i < j->nbinds; i++) {
+    lval *x = j->binds[i]->val;
+    if (!x) {
+      return 0;
+    }
+    if (j->ops[i] >= 0) {
+      if (LVAL_TYPE(x) != LVAL_FUN || x->fun != lvm_arith_funs[j->ops[i]]) {
+        return 0;
+      }
+    } else {
+      if (LVAL_TYPE(x) != LVAL_NUM) {
+        return 0;
+      }
+      args[i] = LVAL_NUM_VALUE(x);
+    }
+  }
+  return j->fn(args, out);
+}
+
+void ljit_free(ljit *j) {
+  if (j->fn) {
+    munmap(*(void **)&j->fn, j->size);
+  }
+  free(j->binds);
+  free(j->ops);
+  free(j);
+}
+
+#else
+
+ljit *ljit_compile(lcode *c) { return NULL; }
+
+int ljit_run(lenv *e, ljit *j, long *out) { return 0; }
+
+void ljit_free(ljit *j) {}
+
+#endif
+
+/*
+ * ################################
+ * #### BUILTIN FUNCTION ##########
+ * ################################
+ * */
+
+/* add all predefined builtin */
+void lenv_add_builtins(lenv *e) {
+  /* list functions */
   lenv_add_builtin(e, "list", builtin_list);
   lenv_add_builtin(e, "head", builtin_head);
   lenv_add_builtin(e, "tail", builtin_tail);
@@ -422,133 +3024,1155 @@ void lenv_add_builtins(lenv *e) {
   lenv_add_builtin(e, "join", builtin_join);
   lenv_add_builtin(e, "def", builtin_def);
 
-  /* math functions" */
-  lenv_add_builtin(e, "+", builtin_add);
-  lenv_add_builtin(e, "-", builtin_sub);
-  lenv_add_builtin(e, "*", builtin_mul);
-  lenv_add_builtin(e, "/", builtin_div);
+  /* math functions" */
+  lenv_add_builtin(e, "+", builtin_add);
+  lenv_add_builtin(e, "-", builtin_sub);
+  lenv_add_builtin(e, "*", builtin_mul);
+  lenv_add_builtin(e, "/", builtin_div);
+  lenv_add_builtin(e, "min", builtin_min);
+  lenv_add_builtin(e, "max", builtin_max);
+  lenv_add_builtin(e, "<", builtin_lt);
+  lenv_add_builtin(e, ">", builtin_gt);
+  lenv_add_builtin(e, "<=", builtin_le);
+  lenv_add_builtin(e, ">=", builtin_ge);
+  lenv_add_builtin(e, "==", builtin_eq);
+  lenv_add_builtin(e, "!=", builtin_ne);
+
+  /* vector functions */
+  lenv_add_builtin(e, "vec", builtin_vec);
+  lenv_add_builtin(e, "vlist", builtin_vlist);
+  lenv_add_builtin(e, "vlen", builtin_vlen);
+  lenv_add_builtin(e, "vget", builtin_vget);
+  lenv_add_builtin(e, "vslice", builtin_vslice);
+  lenv_add_builtin(e, "v+", builtin_vadd);
+  lenv_add_builtin(e, "v-", builtin_vsub);
+  lenv_add_builtin(e, "v*", builtin_vmul);
+  lenv_add_builtin(e, "v/", builtin_vdiv);
+  lenv_add_builtin(e, "vmap", builtin_vmap);
+  lenv_add_builtin(e, "vfilter", builtin_vfilter);
+  lenv_add_builtin(e, "vreduce", builtin_vreduce);
+
+  /* runtime functions */
+  lenv_add_builtin(e, "pool-stats", builtin_pool_stats);
+  lenv_add_builtin(e, "gc-stats", builtin_gc_stats);
+  lenv_add_builtin(e, "tier-stats", builtin_tier_stats);
+}
+
+/* add a custom builtin */
+void lenv_add_builtin(lenv *e, char *name, lbuiltin func) {
+  lval *k = lval_sym(name);
+  lval *v = lval_fun(func);
+
+  lenv_put(e, k, v);
+  lval_del(k);
+  lval_del(v);
+}
+
+lval *builtin(lenv *e, lval *a, char *func) {
+  if (strcmp("list", func) == 0) {
+    return builtin_list(e, a);
+  }
+  if (strcmp("head", func) == 0) {
+    return builtin_head(e, a);
+  }
+  if (strcmp("tail", func) == 0) {
+    return builtin_tail(e, a);
+  }
+  if (strcmp("join", func) == 0) {
+    return builtin_join(e, a);
+  }
+  if (strcmp("eval", func) == 0) {
+    return builtin_eval(e, a);
+  }
+  if (strstr("+-/*", func)) {
+    return builtin_op(e, a, func);
+  }
+  lval_del(a);
+  return lval_err("Unknown Function!");
+}
+
+lval *builtin_def(lenv *e, lval *a) {
+  LASSERT(a, a->count > 0, "Function 'def' passed no arguments.");
+  LASSERT_TYPE("def", a, 0, LVAL_QEXPR);
+
+  lval *syms = a->cell[0];
+
+  for (int i = 0; i < syms->count; i++) {
+    LASSERT(a, LVAL_TYPE(lval_index(syms, i)) == LVAL_SYM,
+            "Function 'def' cannot define non-symbol. "
+            "Got %s, Expected %s.",
+            ltype_name(LVAL_TYPE(lval_index(syms, i))), ltype_name(LVAL_SYM));
+  }
+
+  LASSERT(a, syms->count == a->count - 1,
+          "Function 'def' passed too many arguments for symbols. "
+          "Got %i, Expected %i.",
+          syms->count, a->count - 1);
+
+  for (int i = 0; i < syms->count; i++) {
+    lenv_put(e, lval_index(syms, i), a->cell[i + 1]);
+  }
+  lval_del(a);
+  return lval_sexpr();
+}
+
+/* Arithmetic kernels. Each folds the n numbers in v left to right into
+ * *out and returns 1, or returns 0 on division by zero or overflow,
+ * leaving those to lbig_arith. Callers check the types first. Two
+ * operands, by far the most common, skip the loop. */
+int lkernel_add(lval **v, int n, long *out) {
+  if (n >= LSIMD_MIN && lsimd.sum && lsimd.sum(v, n, out)) {
+    return 1;
+  }
+  long x = LVAL_NUM_VALUE(v[0]);
+  if (n == 2) {
+    return !__builtin_add_overflow(x, LVAL_NUM_VALUE(v[1]), out);
+  }
+  for (int i = 1; i < n; i++) {
+    if (__builtin_add_overflow(x, LVAL_NUM_VALUE(v[i]), &x)) {
+      return 0;
+    }
+  }
+  *out = x;
+  return 1;
+}
+
+int lkernel_sub(lval **v, int n, long *out) {
+  long x = LVAL_NUM_VALUE(v[0]);
+  if (n == 2) {
+    return !__builtin_sub_overflow(x, LVAL_NUM_VALUE(v[1]), out);
+  }
+  /* A lone operand is negated */
+  if (n == 1) {
+    return !__builtin_sub_overflow(0L, x, out);
+  }
+  long y;
+  if (n > LSIMD_MIN && lsimd.sum && lsimd.sum(v + 1, n - 1, &y)) {
+    return !__builtin_sub_overflow(x, y, out);
+  }
+  for (int i = 1; i < n; i++) {
+    if (__builtin_sub_overflow(x, LVAL_NUM_VALUE(v[i]), &x)) {
+      return 0;
+    }
+  }
+  *out = x;
+  return 1;
+}
+
+/* Products stay scalar, the vector units have no 64-bit lane multiply
+ * below AVX-512 */
+int lkernel_mul(lval **v, int n, long *out) {
+  long x = LVAL_NUM_VALUE(v[0]);
+  if (n == 2) {
+    return !__builtin_mul_overflow(x, LVAL_NUM_VALUE(v[1]), out);
+  }
+  for (int i = 1; i < n; i++) {
+    if (__builtin_mul_overflow(x, LVAL_NUM_VALUE(v[i]), &x)) {
+      return 0;
+    }
+  }
+  *out = x;
+  return 1;
+}
+
+int lkernel_div(lval **v, int n, long *out) {
+  long x = LVAL_NUM_VALUE(v[0]);
+  for (int i = 1; i < n; i++) {
+    long y = LVAL_NUM_VALUE(v[i]);
+    /* The least long over -1 overflows too */
+    if (y == 0 || (y == -1 && x == LONG_MIN)) {
+      return 0;
+    }
+    x /= y;
+  }
+  *out = x;
+  return 1;
+}
+
+int lkernel_min(lval **v, int n, long *out) {
+  if (n >= LSIMD_MIN && lsimd.extreme && lsimd.extreme(v, n, 0, out)) {
+    return 1;
+  }
+  long x = LVAL_NUM_VALUE(v[0]);
+  for (int i = 1; i < n; i++) {
+    long y = LVAL_NUM_VALUE(v[i]);
+    x = y < x ? y : x;
+  }
+  *out = x;
+  return 1;
+}
+
+int lkernel_max(lval **v, int n, long *out) {
+  if (n >= LSIMD_MIN && lsimd.extreme && lsimd.extreme(v, n, 1, out)) {
+    return 1;
+  }
+  long x = LVAL_NUM_VALUE(v[0]);
+  for (int i = 1; i < n; i++) {
+    long y = LVAL_NUM_VALUE(v[i]);
+    x = y > x ? y : x;
+  }
+  *out = x;
+  return 1;
+}
+
+/* Element operator op, an index into lelem_funs, on two numbers. The
+ * arithmetic wraps around like machine integers and comparisons give 1
+ * or 0. Returns 0 on division by zero. */
+int lkernel_elem(int op, long a, long b, long *out) {
+  unsigned long ua = a;
+  unsigned long ub = b;
+  switch (op) {
+  case 0:
+    *out = ua + ub;
+    break;
+  case 1:
+    *out = ua - ub;
+    break;
+  case 2:
+    *out = ua * ub;
+    break;
+  case 3:
+    if (b == 0) {
+      return 0;
+    }
+    /* Dividing the least number by -1 would trap */
+    *out = b == -1 ? -ua : (unsigned long)(a / b);
+    break;
+  case 4:
+    *out = a < b ? a : b;
+    break;
+  case 5:
+    *out = a > b ? a : b;
+    break;
+  case 6:
+    *out = a < b;
+    break;
+  case 7:
+    *out = a > b;
+    break;
+  case 8:
+    *out = a <= b;
+    break;
+  case 9:
+    *out = a >= b;
+    break;
+  case 10:
+    *out = a == b;
+    break;
+  default:
+    *out = a != b;
+    break;
+  }
+  return 1;
+}
+
+/* Element-wise kernel for packed vectors: x[i] = x[i] op y[i] for each
+ * of the n numbers in x, or x[i] op k if y is NULL. Returns 0 on
+ * division by zero. */
+int lkernel_vec(int op, long *x, const long *y, long k, int n) {
+  if (lsimd.apply && lsimd.apply(op, x, y, k, n)) {
+    return 1;
+  }
+  for (int i = 0; i < n; i++) {
+    if (!lkernel_elem(op, x[i], y ? y[i] : k, &x[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Fold op left over the n numbers in x, starting from acc. Sums,
+ * differences, minima and maxima of long runs are vectorised. */
+int lkernel_fold(int op, long acc, const long *x, int n, long *out) {
+  long s;
+  if (n >= LSIMD_MIN && lsimd.fold && op <= 5 &&
+      lsimd.fold(op == 1 ? 0 : op, x, n, &s)) {
+    return lkernel_elem(op, acc, s, out);
+  }
+  for (int i = 0; i < n; i++) {
+    if (!lkernel_elem(op, acc, x[i], &acc)) {
+      return 0;
+    }
+  }
+  *out = acc;
+  return 1;
+}
+
+/* The vector kernels work on the tagged words of the cell array. A
+ * fixnum x is stored as 2x + 1, so the words of n fixnums sum to twice
+ * their sum plus n, and compare in the same order as the numbers. They
+ * return 0 if a word is not a fixnum or a lane overflows, and the caller
+ * falls back to the scalar loop. */
+void lsimd_init(void) {
+#ifdef LSIMD
+  if (!lsimd.enabled) {
+    return;
+  }
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    lsimd.sum = lsimd_sum_avx2;
+    lsimd.extreme = lsimd_extreme_avx2;
+    lsimd.apply = lsimd_apply_avx2;
+    lsimd.fold = lsimd_fold_avx2;
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    lsimd.sum = lsimd_sum_sse;
+    lsimd.extreme = lsimd_extreme_sse;
+    lsimd.apply = lsimd_apply_sse;
+    lsimd.fold = lsimd_fold_sse;
+  }
+#endif
+}
+
+#ifdef LSIMD
+
+/* Add the leftover words and the lanes of a vector sum, then untag */
+int lsimd_sum_finish(lval **v, int i, int n, long *lanes, int nlanes,
+                     long *out) {
+  long t = 0;
+  for (int k = 0; k < nlanes; k++) {
+    if (__builtin_add_overflow(t, lanes[k], &t)) {
+      return 0;
+    }
+  }
+  for (; i < n; i++) {
+    if (!LVAL_IS_FIXNUM(v[i]) ||
+        __builtin_add_overflow(t, (long)(intptr_t)v[i], &t)) {
+      return 0;
+    }
+  }
+  *out = (t - n) >> 1;
+  return 1;
+}
+
+/* Pick the least or greatest of the lanes and the leftover words, then
+ * untag */
+int lsimd_extreme_finish(lval **v, int i, int n, long *lanes, int nlanes,
+                         int max, long *out) {
+  long t = lanes[0];
+  for (int k = 1; k < nlanes; k++) {
+    t = (max ? lanes[k] > t : lanes[k] < t) ? lanes[k] : t;
+  }
+  for (; i < n; i++) {
+    long w = (long)(intptr_t)v[i];
+    if (!LVAL_IS_FIXNUM(v[i])) {
+      return 0;
+    }
+    t = (max ? w > t : w < t) ? w : t;
+  }
+  *out = t >> 1;
+  return 1;
+}
+
+/* A lane overflowed if the sign of the sum differs from both addends */
+__attribute__((target("sse4.2"))) int lsimd_sum_sse(lval **v, int n,
+                                                     long *out) {
+  __m128i sum = _mm_setzero_si128();
+  __m128i over = _mm_setzero_si128();
+  __m128i tags = _mm_set1_epi64x(1);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i w = _mm_loadu_si128((const __m128i *)(v + i));
+    __m128i s = _mm_add_epi64(sum, w);
+    over = _mm_or_si128(over, _mm_and_si128(_mm_xor_si128(sum, s),
+                                            _mm_xor_si128(w, s)));
+    tags = _mm_and_si128(tags, w);
+    sum = s;
+  }
+  if (_mm_movemask_pd(_mm_castsi128_pd(over)) ||
+      _mm_movemask_pd(_mm_castsi128_pd(_mm_slli_epi64(tags, 63))) != 0x3) {
+    return 0;
+  }
+  long lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, sum);
+  return lsimd_sum_finish(v, i, n, lanes, 2, out);
+}
+
+__attribute__((target("avx2"))) int lsimd_sum_avx2(lval **v, int n,
+                                                   long *out) {
+  __m256i sum = _mm256_setzero_si256();
+  __m256i over = _mm256_setzero_si256();
+  __m256i tags = _mm256_set1_epi64x(1);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i w = _mm256_loadu_si256((const __m256i *)(v + i));
+    __m256i s = _mm256_add_epi64(sum, w);
+    over = _mm256_or_si256(over, _mm256_and_si256(_mm256_xor_si256(sum, s),
+                                                  _mm256_xor_si256(w, s)));
+    tags = _mm256_and_si256(tags, w);
+    sum = s;
+  }
+  if (_mm256_movemask_pd(_mm256_castsi256_pd(over)) ||
+      _mm256_movemask_pd(
+          _mm256_castsi256_pd(_mm256_slli_epi64(tags, 63))) != 0xF) {
+    return 0;
+  }
+  long lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, sum);
+  return lsimd_sum_finish(v, i, n, lanes, 4, out);
+}
+
+/* Least, or greatest if max is set, of at least four words. Two
+ * running extremes hide the latency of compare and blend. */
+__attribute__((target("sse4.2"))) int
+lsimd_extreme_sse(lval **v, int n, int max, long *out) {
+  __m128i m = _mm_loadu_si128((const __m128i *)v);
+  __m128i m1 = _mm_loadu_si128((const __m128i *)(v + 2));
+  __m128i tags = _mm_and_si128(m, m1);
+  int i = 4;
+  for (; i + 4 <= n; i += 4) {
+    __m128i w = _mm_loadu_si128((const __m128i *)(v + i));
+    __m128i w1 = _mm_loadu_si128((const __m128i *)(v + i + 2));
+    m = _mm_blendv_epi8(m, w, max ? _mm_cmpgt_epi64(w, m)
+                                  : _mm_cmpgt_epi64(m, w));
+    m1 = _mm_blendv_epi8(m1, w1, max ? _mm_cmpgt_epi64(w1, m1)
+                                     : _mm_cmpgt_epi64(m1, w1));
+    tags = _mm_and_si128(tags, _mm_and_si128(w, w1));
+  }
+  m = _mm_blendv_epi8(m, m1, max ? _mm_cmpgt_epi64(m1, m)
+                                 : _mm_cmpgt_epi64(m, m1));
+  if (_mm_movemask_pd(_mm_castsi128_pd(_mm_slli_epi64(tags, 63))) != 0x3) {
+    return 0;
+  }
+  long lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, m);
+  return lsimd_extreme_finish(v, i, n, lanes, 2, max, out);
+}
+
+/* Least, or greatest if max is set, of at least eight words */
+__attribute__((target("avx2"))) int
+lsimd_extreme_avx2(lval **v, int n, int max, long *out) {
+  __m256i m = _mm256_loadu_si256((const __m256i *)v);
+  __m256i m1 = _mm256_loadu_si256((const __m256i *)(v + 4));
+  __m256i tags = _mm256_and_si256(m, m1);
+  int i = 8;
+  for (; i + 8 <= n; i += 8) {
+    __m256i w = _mm256_loadu_si256((const __m256i *)(v + i));
+    __m256i w1 = _mm256_loadu_si256((const __m256i *)(v + i + 4));
+    m = _mm256_blendv_epi8(m, w, max ? _mm256_cmpgt_epi64(w, m)
+                                     : _mm256_cmpgt_epi64(m, w));
+    m1 = _mm256_blendv_epi8(m1, w1, max ? _mm256_cmpgt_epi64(w1, m1)
+                                        : _mm256_cmpgt_epi64(m1, w1));
+    tags = _mm256_and_si256(tags, _mm256_and_si256(w, w1));
+  }
+  m = _mm256_blendv_epi8(m, m1, max ? _mm256_cmpgt_epi64(m1, m)
+                                    : _mm256_cmpgt_epi64(m, m1));
+  if (_mm256_movemask_pd(
+          _mm256_castsi256_pd(_mm256_slli_epi64(tags, 63))) != 0xF) {
+    return 0;
+  }
+  long lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, m);
+  return lsimd_extreme_finish(v, i, n, lanes, 4, max, out);
+}
+
+/* Element operator op, other than * and /, on each lane, see
+ * lkernel_elem. Comparisons turn all-ones masks into 1. */
+static __attribute__((target("sse4.2"))) __m128i lsimd_op_sse(int op,
+                                                                __m128i a,
+                                                                __m128i b) {
+  __m128i one = _mm_set1_epi64x(1);
+  switch (op) {
+  case 0:
+    return _mm_add_epi64(a, b);
+  case 1:
+    return _mm_sub_epi64(a, b);
+  case 4:
+    return _mm_blendv_epi8(a, b, _mm_cmpgt_epi64(a, b));
+  case 5:
+    return _mm_blendv_epi8(a, b, _mm_cmpgt_epi64(b, a));
+  case 6:
+    return _mm_and_si128(_mm_cmpgt_epi64(b, a), one);
+  case 7:
+    return _mm_and_si128(_mm_cmpgt_epi64(a, b), one);
+  case 8:
+    return _mm_andnot_si128(_mm_cmpgt_epi64(a, b), one);
+  case 9:
+    return _mm_andnot_si128(_mm_cmpgt_epi64(b, a), one);
+  case 10:
+    return _mm_and_si128(_mm_cmpeq_epi64(a, b), one);
+  default:
+    return _mm_andnot_si128(_mm_cmpeq_epi64(a, b), one);
+  }
+}
+
+static __attribute__((target("avx2"))) __m256i lsimd_op_avx2(int op,
+                                                               __m256i a,
+                                                               __m256i b) {
+  __m256i one = _mm256_set1_epi64x(1);
+  switch (op) {
+  case 0:
+    return _mm256_add_epi64(a, b);
+  case 1:
+    return _mm256_sub_epi64(a, b);
+  case 4:
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+  case 5:
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(b, a));
+  case 6:
+    return _mm256_and_si256(_mm256_cmpgt_epi64(b, a), one);
+  case 7:
+    return _mm256_and_si256(_mm256_cmpgt_epi64(a, b), one);
+  case 8:
+    return _mm256_andnot_si256(_mm256_cmpgt_epi64(a, b), one);
+  case 9:
+    return _mm256_andnot_si256(_mm256_cmpgt_epi64(b, a), one);
+  case 10:
+    return _mm256_and_si256(_mm256_cmpeq_epi64(a, b), one);
+  default:
+    return _mm256_andnot_si256(_mm256_cmpeq_epi64(a, b), one);
+  }
+}
+
+/* lkernel_vec for every operator but * and /, which return 0 */
+__attribute__((target("sse4.2"))) int
+lsimd_apply_sse(int op, long *x, const long *y, long k, int n) {
+  if (op == 2 || op == 3) {
+    return 0;
+  }
+  __m128i b = _mm_set1_epi64x(k);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(x + i));
+    if (y) {
+      b = _mm_loadu_si128((const __m128i *)(y + i));
+    }
+    _mm_storeu_si128((__m128i *)(x + i), lsimd_op_sse(op, a, b));
+  }
+  for (; i < n; i++) {
+    lkernel_elem(op, x[i], y ? y[i] : k, &x[i]);
+  }
+  return 1;
+}
+
+__attribute__((target("avx2"))) int
+lsimd_apply_avx2(int op, long *x, const long *y, long k, int n) {
+  if (op == 2 || op == 3) {
+    return 0;
+  }
+  __m256i b = _mm256_set1_epi64x(k);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(x + i));
+    if (y) {
+      b = _mm256_loadu_si256((const __m256i *)(y + i));
+    }
+    _mm256_storeu_si256((__m256i *)(x + i), lsimd_op_avx2(op, a, b));
+  }
+  for (; i < n; i++) {
+    lkernel_elem(op, x[i], y ? y[i] : k, &x[i]);
+  }
+  return 1;
+}
+
+/* Fold +, min or max over at least four numbers, 0 for the other
+ * operators. The lanes fold separately, then into each other. */
+__attribute__((target("sse4.2"))) int lsimd_fold_sse(int op, const long *x,
+                                                     int n, long *out) {
+  if (op != 0 && op != 4 && op != 5) {
+    return 0;
+  }
+  __m128i acc = _mm_loadu_si128((const __m128i *)x);
+  int i = 2;
+  for (; i + 2 <= n; i += 2) {
+    acc = lsimd_op_sse(op, acc, _mm_loadu_si128((const __m128i *)(x + i)));
+  }
+  long lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  long r = lanes[0];
+  lkernel_elem(op, r, lanes[1], &r);
+  for (; i < n; i++) {
+    lkernel_elem(op, r, x[i], &r);
+  }
+  *out = r;
+  return 1;
+}
+
+__attribute__((target("avx2"))) int lsimd_fold_avx2(int op, const long *x,
+                                                    int n, long *out) {
+  if (op != 0 && op != 4 && op != 5) {
+    return 0;
+  }
+  __m256i acc = _mm256_loadu_si256((const __m256i *)x);
+  int i = 4;
+  for (; i + 4 <= n; i += 4) {
+    acc = lsimd_op_avx2(op, acc,
+                        _mm256_loadu_si256((const __m256i *)(x + i)));
+  }
+  long lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  long r = lanes[0];
+  for (int k = 1; k < 4; k++) {
+    lkernel_elem(op, r, lanes[k], &r);
+  }
+  for (; i < n; i++) {
+    lkernel_elem(op, r, x[i], &r);
+  }
+  *out = r;
+  return 1;
+}
+
+#else
+
+int lsimd_sum_sse(lval **v, int n, long *out) { return 0; }
+
+int lsimd_sum_avx2(lval **v, int n, long *out) { return 0; }
+
+int lsimd_extreme_sse(lval **v, int n, int max, long *out) { return 0; }
+
+int lsimd_extreme_avx2(lval **v, int n, int max, long *out) { return 0; }
+
+int lsimd_apply_sse(int op, long *x, const long *y, long k, int n) {
+  return 0;
 }
 
-/* add a custom builtin */
-void lenv_add_builtin(lenv *e, char *name, lbuiltin func) {
-  lval *k = lval_sym(name);
-  lval *v = lval_fun(func);
+int lsimd_apply_avx2(int op, long *x, const long *y, long k, int n) {
+  return 0;
+}
 
-  lenv_put(e, k, v);
-  lval_del(k);
-  lval_del(v);
+int lsimd_fold_sse(int op, const long *x, int n, long *out) { return 0; }
+
+int lsimd_fold_avx2(int op, const long *x, int n, long *out) { return 0; }
+
+#endif
+
+/* Apply arithmetic operator op, an index into larith_names, to a */
+lval *builtin_arith(lenv *e, lval *a, int op) {
+  LASSERT(a, a->count > 0, "Function '%s' passed no arguments.",
+          larith_names[op]);
+  int i = 0;
+  while (i < a->count && LVAL_TYPE(a->cell[i]) == LVAL_NUM) {
+    i++;
+  }
+  long x;
+  if (i == a->count && larith_kernels[op](a->cell, a->count, &x)) {
+    lval_del(a);
+    return lval_num(x);
+  }
+
+  /* Ensure all arguments are numbers, reporting the first that is not,
+   * then redo the call exactly */
+  for (; i < a->count; i++) {
+    if (LVAL_TYPE(a->cell[i]) != LVAL_BIG) {
+      LASSERT_TYPE("op", a, i, LVAL_NUM);
+    }
+  }
+  return lbig_arith(a, op);
 }
 
-lval *builtin(lenv *e, lval *a, char *func) {
-  if (strcmp("list", func) == 0) {
-    return builtin_list(e, a);
+lval *builtin_op(lenv *e, lval *a, char *op) {
+  return builtin_arith(e, a, (int)(strchr(lvm_arith_syms, op[0]) -
+                                   lvm_arith_syms));
+}
+
+lval *builtin_add(lenv *e, lval *a) { return builtin_arith(e, a, 0); }
+
+lval *builtin_sub(lenv *e, lval *a) { return builtin_arith(e, a, 1); }
+
+lval *builtin_mul(lenv *e, lval *a) { return builtin_arith(e, a, 2); }
+
+lval *builtin_div(lenv *e, lval *a) { return builtin_arith(e, a, 3); }
+
+lval *builtin_min(lenv *e, lval *a) { return builtin_arith(e, a, 4); }
+
+lval *builtin_max(lenv *e, lval *a) { return builtin_arith(e, a, 5); }
+
+lval *builtin_vec(lenv *e, lval *a) {
+  LASSERT_COUNT("vec", a, 1);
+  LASSERT_TYPE("vec", a, 0, LVAL_QEXPR);
+
+  /* Pack until the first element that is not a number, if any */
+  lval *q = a->cell[0];
+  lval *v = lval_vec(q->count);
+  int i = 0;
+  for (; i < q->count; i++) {
+    lval *x = lval_index(q, i);
+    if (LVAL_TYPE(x) != LVAL_NUM) {
+      break;
+    }
+    v->ints[i] = LVAL_NUM_VALUE(x);
   }
-  if (strcmp("head", func) == 0) {
-    return builtin_head(e, a);
+  if (i < q->count) {
+    lval *err = lval_err("Function 'vec' passed non-number at position %i. "
+                         "Got %s, Expected %s.",
+                         i, ltype_name(LVAL_TYPE(lval_index(q, i))),
+                         ltype_name(LVAL_NUM));
+    lval_del(v);
+    lval_del(a);
+    return err;
   }
-  if (strcmp("tail", func) == 0) {
-    return builtin_tail(e, a);
+  lval_del(a);
+  return v;
+}
+
+lval *builtin_vlist(lenv *e, lval *a) {
+  LASSERT_COUNT("vlist", a, 1);
+  LASSERT_TYPE("vlist", a, 0, LVAL_VEC);
+
+  lval *v = a->cell[0];
+  lval *q = lval_qexpr();
+  lval_cells_reserve(q, v->count);
+  for (int i = 0; i < v->count; i++) {
+    q->cell[i] = lval_num(v->ints[i]);
   }
-  if (strcmp("join", func) == 0) {
-    return builtin_join(e, a);
+  q->count = v->count;
+  lval_del(a);
+  return q;
+}
+
+lval *builtin_vlen(lenv *e, lval *a) {
+  LASSERT_COUNT("vlen", a, 1);
+  LASSERT_TYPE("vlen", a, 0, LVAL_VEC);
+
+  lval *x = lval_num(a->cell[0]->count);
+  lval_del(a);
+  return x;
+}
+
+lval *builtin_vget(lenv *e, lval *a) {
+  LASSERT_COUNT("vget", a, 2);
+  LASSERT_TYPE("vget", a, 0, LVAL_VEC);
+  LASSERT_TYPE("vget", a, 1, LVAL_NUM);
+
+  long i = LVAL_NUM_VALUE(a->cell[1]);
+  LASSERT(a, i >= 0 && i < a->cell[0]->count,
+          "Function 'vget' passed index %li out of range for length %i.", i,
+          a->cell[0]->count);
+  lval *x = lval_num(a->cell[0]->ints[i]);
+  lval_del(a);
+  return x;
+}
+
+/* (vslice v start len) copies len numbers of v from position start */
+lval *builtin_vslice(lenv *e, lval *a) {
+  LASSERT_COUNT("vslice", a, 3);
+  LASSERT_TYPE("vslice", a, 0, LVAL_VEC);
+  LASSERT_TYPE("vslice", a, 1, LVAL_NUM);
+  LASSERT_TYPE("vslice", a, 2, LVAL_NUM);
+
+  lval *v = a->cell[0];
+  long start = LVAL_NUM_VALUE(a->cell[1]);
+  long len = LVAL_NUM_VALUE(a->cell[2]);
+  LASSERT(a, start >= 0 && len >= 0 && len <= v->count - start,
+          "Function 'vslice' passed range %li to %li out of range for "
+          "length %i.",
+          start, start + len, v->count);
+  lval *x = lval_vec((int)len);
+  memcpy(x->ints, v->ints + start, sizeof(long) * len);
+  lval_del(a);
+  return x;
+}
+
+static char *const lvarith_names[] = {"v+", "v-", "v*", "v/"};
+
+/* Element-wise operator op, an index into lvarith_names, on vectors of
+ * one length. Numbers stand for vectors of copies of themselves. */
+lval *builtin_varith(lenv *e, lval *a, int op) {
+  char *name = lvarith_names[op];
+  LASSERT(a, a->count > 0, "Function '%s' passed no arguments.", name);
+
+  int n = -1;
+  for (int i = 0; i < a->count; i++) {
+    int t = LVAL_TYPE(a->cell[i]);
+    LASSERT(a, t == LVAL_VEC || t == LVAL_NUM,
+            "Function '%s' passed incorrect type for argument %i. Got %s, "
+            "Expected %s or %s.",
+            name, i, ltype_name(t), ltype_name(LVAL_VEC),
+            ltype_name(LVAL_NUM));
+    if (t != LVAL_VEC) {
+      continue;
+    }
+    LASSERT(a, n < 0 || a->cell[i]->count == n,
+            "Function '%s' passed vectors of different lengths. "
+            "Got %i, Expected %i.",
+            name, a->cell[i]->count, n);
+    n = a->cell[i]->count;
   }
-  if (strcmp("eval", func) == 0) {
-    return builtin_eval(e, a);
+  LASSERT(a, n >= 0, "Function '%s' passed no vectors.", name);
+
+  /* Fold left over the arguments into a new vector */
+  lval *x = lval_vec(n);
+  lval *y = a->cell[0];
+  if (LVAL_TYPE(y) == LVAL_VEC) {
+    memcpy(x->ints, y->ints, sizeof(long) * n);
+  } else {
+    for (int i = 0; i < n; i++) {
+      x->ints[i] = LVAL_NUM_VALUE(y);
+    }
   }
-  if (strstr("+-/*", func)) {
-    return builtin_op(e, a, func);
+  /* A lone vector is negated, like a lone number */
+  if (a->count == 1 && op == 1) {
+    memset(x->ints, 0, sizeof(long) * n);
+    lkernel_vec(1, x->ints, y->ints, 0, n);
+  }
+  for (int i = 1; i < a->count; i++) {
+    if (!lval_vec_apply(x, op, a->cell[i])) {
+      lval_del(x);
+      lval_del(a);
+      return lval_err("Division by Zero");
+    }
   }
   lval_del(a);
-  return lval_err("Unknown Function!");
+  return x;
 }
 
-lval *builtin_def(lenv *e, lval *a) {
-  LASSERT_TYPE("def", a, 0, LVAL_QEXPR);
+lval *builtin_vadd(lenv *e, lval *a) { return builtin_varith(e, a, 0); }
 
-  lval *syms = a->cell[0];
+lval *builtin_vsub(lenv *e, lval *a) { return builtin_varith(e, a, 1); }
 
-  for (int i = 0; i < syms->count; i++) {
-    LASSERT(a, syms->cell[i]->type == LVAL_SYM,
-            "Function 'def' cannot define non-symbol. "
-            "Got %s, Expected %s.",
-            ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+lval *builtin_vmul(lenv *e, lval *a) { return builtin_varith(e, a, 2); }
+
+lval *builtin_vdiv(lenv *e, lval *a) { return builtin_varith(e, a, 3); }
+
+/* Apply element operator op to the vector x in place, with y a vector of
+ * the same length or a number. Returns 0 on division by zero. */
+int lval_vec_apply(lval *x, int op, lval *y) {
+  if (LVAL_TYPE(y) == LVAL_VEC) {
+    return lkernel_vec(op, x->ints, y->ints, 0, x->count);
   }
+  return lkernel_vec(op, x->ints, NULL, LVAL_NUM_VALUE(y), x->count);
+}
 
-  LASSERT(a, syms->count == a->count - 1,
-          "Function 'def' passed too many arguments for symbols. "
-          "Got %i, Expected %i.",
-          syms->count, a->count - 1);
+static char *const lcmp_names[] = {"<", ">", "<=", ">=", "==", "!="};
 
-  for (int i = 0; i < syms->count; i++) {
-    lenv_put(e, syms->cell[i], a->cell[i + 1]);
+/* Compare two numbers with comparison op, an index into lcmp_names,
+ * giving 1 if it holds and 0 if not */
+lval *builtin_cmp(lenv *e, lval *a, int op) {
+  char *name = lcmp_names[op];
+  LASSERT_COUNT(name, a, 2);
+  for (int i = 0; i < 2; i++) {
+    if (LVAL_TYPE(a->cell[i]) != LVAL_BIG) {
+      LASSERT_TYPE(name, a, i, LVAL_NUM);
+    }
+  }
+
+  long x;
+  if (LVAL_TYPE(a->cell[0]) == LVAL_NUM && LVAL_TYPE(a->cell[1]) == LVAL_NUM) {
+    lkernel_elem(LELEM_CMP + op, LVAL_NUM_VALUE(a->cell[0]),
+                 LVAL_NUM_VALUE(a->cell[1]), &x);
+  } else {
+    /* Compare the sign of the difference with 0 instead */
+    uint32_t xbuf[LBIG_LONG_LIMBS];
+    uint32_t ybuf[LBIG_LONG_LIMBS];
+    lbig bx;
+    lbig by;
+    lbig_view(&bx, a->cell[0], xbuf);
+    lbig_view(&by, a->cell[1], ybuf);
+    lkernel_elem(LELEM_CMP + op, lbig_cmp(&bx, &by), 0, &x);
   }
   lval_del(a);
-  return lval_sexpr();
+  return lval_num(x);
 }
 
-lval *builtin_op(lenv *e, lval *a, char *op) {
-  /* Ensure all alrguments are numbers*/
-  for (int i = 0; i < a->count; i++) {
-    // if (a->cell[i]->type != LVAL_NUM) {
-    //   lval_del(a);
-    //   return lval_err("Cannot operate on non-number");
-    // }
-    LASSERT_TYPE("op", a, i, LVAL_NUM);
+lval *builtin_lt(lenv *e, lval *a) { return builtin_cmp(e, a, 0); }
+
+lval *builtin_gt(lenv *e, lval *a) { return builtin_cmp(e, a, 1); }
+
+lval *builtin_le(lenv *e, lval *a) { return builtin_cmp(e, a, 2); }
+
+lval *builtin_ge(lenv *e, lval *a) { return builtin_cmp(e, a, 3); }
+
+lval *builtin_eq(lenv *e, lval *a) { return builtin_cmp(e, a, 4); }
+
+lval *builtin_ne(lenv *e, lval *a) { return builtin_cmp(e, a, 5); }
+
+/*
+ * vmap, vfilter and vreduce take a function and a vector or Q-expression.
+ * (vmap f v x ...) applies (f e x ...) to every element e, (vfilter f v
+ * x ...) keeps the elements for which that is a number other than 0, and
+ * (vreduce f v) folds (f acc e) left over the elements, starting from
+ * the first or from a third argument. When v is a vector and f one of
+ * the builtins in lelem_funs with at most a number or a vector of the
+ * same length after it, the whole call is one loop over the packed
+ * numbers. Anything else calls f once per element.
+ * */
+
+/* Return the index of f in lelem_funs, or -1 */
+int lelem_op(lval *f) {
+  if (LVAL_TYPE(f) != LVAL_FUN) {
+    return -1;
   }
+  for (int i = 0; i < (int)(sizeof(lelem_funs) / sizeof(lelem_funs[0]));
+       i++) {
+    if (f->fun == lelem_funs[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Element i of the vector or Q-expression v, as a new reference */
+lval *lelem_get(lval *v, int i) {
+  if (LVAL_TYPE(v) == LVAL_VEC) {
+    return lval_num(v->ints[i]);
+  }
+  return lval_ref(lval_index(v, i));
+}
+
+/* Evaluate (f x y rest...), consuming x and y, which may be NULL */
+lval *lelem_call(lenv *e, lval *f, lval *x, lval *y, lval **rest, int nrest) {
+  lval *s = lval_sexpr();
+  lval_add(s, lval_ref(f));
+  lval_add(s, x);
+  if (y) {
+    lval_add(s, y);
+  }
+  for (int i = 0; i < nrest; i++) {
+    lval_add(s, lval_ref(rest[i]));
+  }
+  /* Not a tail call, the caller still has work to do */
+  ltail.ok = 0;
+  return lval_call(e, s);
+}
 
-  /*Pop first element */
-  lval *x = lval_pop(a, 0);
-  /* If no other elements in cell and operator is negative*/
-  if (a->count == 0 && strcmp(op, "-") == 0) {
-    x->num = -x->num;
+/* Whether (f v y) can run as element operator op on packed numbers */
+int lelem_fast(lval *a, int op) {
+  if (op < 0 || LVAL_TYPE(a->cell[1]) != LVAL_VEC || a->count != 3) {
+    return 0;
   }
+  lval *y = a->cell[2];
+  return LVAL_TYPE(y) == LVAL_NUM ||
+         (LVAL_TYPE(y) == LVAL_VEC && y->count == a->cell[1]->count);
+}
+
+/* Check the function and sequence arguments of vmap and friends */
+#define LASSERT_ELEM(func, args)                                              \
+  LASSERT_TYPE(func, args, 0, LVAL_FUN);                                      \
+  LASSERT(args,                                                               \
+          LVAL_TYPE(args->cell[1]) == LVAL_VEC ||                             \
+              LVAL_TYPE(args->cell[1]) == LVAL_QEXPR,                         \
+          "Function '%s' passed incorrect type for argument 1. Got %s, "      \
+          "Expected %s or %s.",                                               \
+          func, ltype_name(LVAL_TYPE(args->cell[1])), ltype_name(LVAL_VEC),   \
+          ltype_name(LVAL_QEXPR));
 
-  while (a->count > 0) {
-    lval *y = lval_pop(a, 0);
+lval *builtin_vmap(lenv *e, lval *a) {
+  LASSERT(a, a->count >= 2,
+          "Function 'vmap' passed too few arguments. Got %i, Expected 2.",
+          a->count);
+  LASSERT_ELEM("vmap", a);
+
+  lval *v = a->cell[1];
+  int op = lelem_op(a->cell[0]);
+  if (lelem_fast(a, op)) {
+    lval *x = lval_vec(v->count);
+    memcpy(x->ints, v->ints, sizeof(long) * v->count);
+    if (!lval_vec_apply(x, op, a->cell[2])) {
+      lval_del(x);
+      lval_del(a);
+      return lval_err("Division by Zero");
+    }
+    lval_del(a);
+    return x;
+  }
 
-    if (strcmp(op, "+") == 0) {
-      x->num += y->num;
+  /* Results go into a vector for a vector, a Q-expression otherwise */
+  int vec = LVAL_TYPE(v) == LVAL_VEC;
+  lval *r = vec ? lval_vec(v->count) : lval_qexpr();
+  lgc_push(a);
+  lgc_push(r);
+  for (int i = 0; i < v->count; i++) {
+    lval *y = lelem_call(e, a->cell[0], lelem_get(v, i), NULL, a->cell + 2,
+                         a->count - 2);
+    if (vec && LVAL_TYPE(y) != LVAL_NUM) {
+      lval *err =
+          LVAL_TYPE(y) == LVAL_ERR
+              ? y
+              : lval_err("Function 'vmap' got %s for a vector, Expected %s.",
+                         ltype_name(LVAL_TYPE(y)), ltype_name(LVAL_NUM));
+      if (err != y) {
+        lval_del(y);
+      }
+      lgc_pop();
+      lgc_pop();
+      lval_del(r);
+      lval_del(a);
+      return err;
     }
-    if (strcmp(op, "-") == 0) {
-      x->num -= y->num;
+    if (LVAL_TYPE(y) == LVAL_ERR) {
+      lgc_pop();
+      lgc_pop();
+      lval_del(r);
+      lval_del(a);
+      return y;
+    }
+    if (vec) {
+      r->ints[i] = LVAL_NUM_VALUE(y);
+      lval_del(y);
+    } else {
+      lval_add(r, y);
+    }
+  }
+  lgc_pop();
+  lgc_pop();
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_vfilter(lenv *e, lval *a) {
+  LASSERT(a, a->count >= 2,
+          "Function 'vfilter' passed too few arguments. Got %i, Expected 2.",
+          a->count);
+  LASSERT_ELEM("vfilter", a);
+
+  lval *v = a->cell[1];
+  int op = lelem_op(a->cell[0]);
+  if (lelem_fast(a, op)) {
+    /* Work out every test at once, then keep the elements that passed */
+    lval *m = lval_vec(v->count);
+    memcpy(m->ints, v->ints, sizeof(long) * v->count);
+    if (!lval_vec_apply(m, op, a->cell[2])) {
+      lval_del(m);
+      lval_del(a);
+      return lval_err("Division by Zero");
     }
-    if (strcmp(op, "*") == 0) {
-      x->num *= y->num;
+    lval *x = lval_vec(v->count);
+    int n = 0;
+    for (int i = 0; i < v->count; i++) {
+      x->ints[n] = v->ints[i];
+      n += m->ints[i] != 0;
     }
-    if (strcmp(op, "/") == 0) {
-      if (y->num == 0) {
-        lval_del(x);
+    x->count = n;
+    lval_del(m);
+    lval_del(a);
+    return x;
+  }
+
+  int vec = LVAL_TYPE(v) == LVAL_VEC;
+  lval *r = vec ? lval_vec(v->count) : lval_qexpr();
+  int n = 0;
+  lgc_push(a);
+  lgc_push(r);
+  for (int i = 0; i < v->count; i++) {
+    lval *y = lelem_call(e, a->cell[0], lelem_get(v, i), NULL, a->cell + 2,
+                         a->count - 2);
+    if (LVAL_TYPE(y) != LVAL_NUM) {
+      lval *err =
+          LVAL_TYPE(y) == LVAL_ERR
+              ? y
+              : lval_err("Function 'vfilter' got %s from its test, "
+                         "Expected %s.",
+                         ltype_name(LVAL_TYPE(y)), ltype_name(LVAL_NUM));
+      if (err != y) {
         lval_del(y);
-        x = lval_err("Division by Zero");
-        break;
       }
-      x->num /= y->num;
+      lgc_pop();
+      lgc_pop();
+      r->count = vec ? n : r->count;
+      lval_del(r);
+      lval_del(a);
+      return err;
+    }
+    if (LVAL_NUM_VALUE(y) != 0) {
+      if (vec) {
+        r->ints[n++] = v->ints[i];
+      } else {
+        lval_add(r, lval_ref(lval_index(v, i)));
+      }
     }
     lval_del(y);
   }
+  if (vec) {
+    r->count = n;
+  }
+  lgc_pop();
+  lgc_pop();
   lval_del(a);
-  return x;
+  return r;
+}
+
+lval *builtin_vreduce(lenv *e, lval *a) {
+  LASSERT(a, a->count == 2 || a->count == 3,
+          "Function 'vreduce' passed incorrect number of arguments. Got %i, "
+          "Expected 2 or 3.",
+          a->count);
+  LASSERT_ELEM("vreduce", a);
+
+  lval *v = a->cell[1];
+  int init = a->count == 3;
+  LASSERT(a, init || v->count > 0,
+          "Function 'vreduce' passed an empty sequence and no initial "
+          "value.");
+
+  int op = lelem_op(a->cell[0]);
+  if (op >= 0 && LVAL_TYPE(v) == LVAL_VEC &&
+      (!init || LVAL_TYPE(a->cell[2]) == LVAL_NUM)) {
+    long acc = init ? LVAL_NUM_VALUE(a->cell[2]) : v->ints[0];
+    if (!lkernel_fold(op, acc, v->ints + !init, v->count - !init, &acc)) {
+      lval_del(a);
+      return lval_err("Division by Zero");
+    }
+    lval_del(a);
+    return lval_num(acc);
+  }
+
+  lval *acc = init ? lval_ref(a->cell[2]) : lelem_get(v, 0);
+  lgc_push(a);
+  for (int i = !init; i < v->count && LVAL_TYPE(acc) != LVAL_ERR; i++) {
+    acc = lelem_call(e, a->cell[0], acc, lelem_get(v, i), NULL, 0);
+  }
+  lgc_pop();
+  lval_del(a);
+  return acc;
+}
+
+lval *builtin_pool_stats(lenv *e, lval *a) {
+  LASSERT_COUNT("pool-stats", a, 0);
+
+  long capacity = lpool.nslabs * LPOOL_SLAB_SIZE;
+  printf("slabs: %li, capacity: %li, live: %li, free: %li, "
+         "occupancy: %.1f%%, node size: %zu bytes, live bytes: %zu\n",
+         lpool.nslabs, capacity, lpool.live, capacity - lpool.live,
+         capacity ? 100.0 * lpool.live / capacity : 0.0, sizeof(lval),
+         lpool.live * sizeof(lval));
+  lval_del(a);
+  return lval_sexpr();
 }
 
-lval *builtin_add(lenv *e, lval *a) { return builtin_op(e, a, "+"); }
+lval *builtin_gc_stats(lenv *e, lval *a) {
+  LASSERT_COUNT("gc-stats", a, 0);
 
-lval *builtin_sub(lenv *e, lval *a) { return builtin_op(e, a, "-"); }
+  printf("mode: %s, collections: %li, last pause: %.3f ms, "
+         "max pause: %.3f ms, total pause: %.3f ms, live nodes: %li, "
+         "live bytes: %li\n",
+         lgc.enabled ? "tracing" : "refcount", lgc.collections,
+         lgc.last_pause * 1000, lgc.max_pause * 1000, lgc.total_pause * 1000,
+         lgc.live_nodes, lgc.live_bytes);
+  printf("nursery: %li of %i nodes used, minor collections: %li, "
+         "promoted: %li\n",
+         (long)(lnursery.top - lnursery.start), LNURSERY_SIZE,
+         lnursery.collections, lnursery.promoted);
+  printf("region: %zu bytes used, peak: %zu bytes\n", lregion.used,
+         lregion.peak);
+  lval_del(a);
+  return lval_sexpr();
+}
 
-lval *builtin_mul(lenv *e, lval *a) { return builtin_op(e, a, "*"); }
+lval *builtin_tier_stats(lenv *e, lval *a) {
+  LASSERT_COUNT("tier-stats", a, 0);
 
-lval *builtin_div(lenv *e, lval *a) { return builtin_op(e, a, "/"); }
+  for (int i = 0; i < LTIER_COUNT; i++) {
+    printf("%s: evals: %li, time: %.1f ms\n", ltier_names[i],
+           ltier.evals[i], ltier.time[i] / 1e6);
+  }
+  /* Then every definition that has been evaluated */
+  for (int i = 0; i < e->count; i++) {
+    lval *v = e->order[i]->val;
+    lcode *c = !v || LVAL_IS_FIXNUM(v) ? NULL : lcode_find(v);
+    if (c) {
+      printf("%s: tier: %s, evals: %li, time: %.1f ms\n", e->order[i]->sym,
+             ltier_names[c->tier], c->hits, c->time / 1e6);
+    }
+  }
+  lval_del(a);
+  return lval_sexpr();
+}
 
 lval *builtin_head(lenv *e, lval *a) {
   LASSERT_COUNT("head", a, 1);
   LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
   LASSERT_NOT_EMPTY("head", a, 0);
 
-  lval *x = lval_take(a, 0);
-
-  while (x->count > 1) {
-    lval_del(lval_pop(x, 1));
-  }
-  return x;
+  return lval_slice(lval_take(a, 0), 0, 1);
 }
 
 lval *builtin_tail(lenv *e, lval *a) {
@@ -557,8 +4181,7 @@ lval *builtin_tail(lenv *e, lval *a) {
   LASSERT_NOT_EMPTY("tail", a, 0);
 
   lval *v = lval_take(a, 0);
-  lval_del(lval_pop(v, 0));
-  return v;
+  return lval_slice(v, 1, v->count - 1);
 }
 
 lval *builtin_list(lenv *e, lval *a) {
@@ -571,28 +4194,80 @@ lval *builtin_eval(lenv *e, lval *a) {
   LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
 
   lval *x = lval_take(a, 0);
-  x->type = LVAL_SEXPR;
-  return lval_eval(e, x);
+  /* Called last, leave x to the evaluation that is finishing */
+  if (ltail.ok) {
+    ltail.ok = 0;
+    ltail.pending = x;
+    return LVAL_TAIL;
+  }
+  return lvm_eval(e, x);
 }
 
 lval *builtin_join(lenv *e, lval *a) {
+  LASSERT(a, a->count > 0, "Function 'join' passed no arguments.");
   for (int i = 0; i < a->count; i++) {
     LASSERT_TYPE("join", a, i, LVAL_QEXPR);
   }
-  lval *x = lval_pop(a, 0);
+  /* Size the result once, then append every argument into it. The first
+   * argument is extended in place when nothing else can see it, and a
+   * tree by adding to a new version of it. */
+  int total = 0;
+  for (int i = 0; i < a->count; i++) {
+    total += a->cell[i]->count;
+  }
+  int i = 0;
+  lval *x;
+  if (a->cell[0]->tree) {
+    x = lvec_unshare(a->cell[i++]);
+  } else if (lval_mutable(a->cell[0])) {
+    x = a->cell[i++];
+  } else {
+    x = lval_qexpr();
+  }
+  if (!x->tree) {
+    lval_cells_reserve(x, total);
+  }
 
-  while (a->count) {
-    x = lval_join(x, lval_pop(a, 0));
+  while (i < a->count) {
+    x = lval_join(x, a->cell[i++]);
   }
+  a->count = 0;
   lval_del(a);
   return x;
 }
 
+/* Append the elements of y to x, consuming y */
 lval *lval_join(lval *x, lval *y) {
-  while (y->count) {
-    x = lval_add(x, lval_pop(y, 0));
+  /* Fill a tree a leaf at a time */
+  if (x->tree) {
+    int i = 0;
+    while (i < y->count) {
+      lvnode *leaf = lvec_leaf(x, x->count);
+      int k = (x->vec->start + x->count) & LVEC_MASK;
+      for (; k < LVEC_WIDTH && i < y->count; k++) {
+        if (leaf->slot[k]) {
+          lval_del(leaf->slot[k]);
+        }
+        leaf->slot[k] = lval_promote(lval_index(y, i++));
+        x->count++;
+      }
+    }
+    lval_del(y);
+    return x;
   }
 
+  lval_cells_reserve(x, x->count + y->count);
+
+  if (lval_mutable(y) && y->count > 0) {
+    /* Nothing else sees y, so its elements just move over */
+    memcpy(&x->cell[x->count], y->cell, sizeof(lval *) * y->count);
+    x->count += y->count;
+    y->count = 0;
+  } else {
+    for (int i = 0; i < y->count; i++) {
+      x->cell[x->count++] = lval_ref(lval_index(y, i));
+    }
+  }
   lval_del(y);
   return x;
 }
@@ -610,12 +4285,19 @@ lval *lval_pop(lval *v, int i) {
   /* Decrease the count of the items in the list */
   v->count--;
 
-  /* Reallocate the memory used*/
-  v->cell = realloc(v->cell, sizeof(lval *) * v->count);
+  /* Keep the capacity around unless most of it is unused */
+  lval_cells_shrink(v);
   return x;
 }
 
 lval *lval_take(lval *v, int i) {
+  /* A shared list or a view stays intact, we just keep a reference to the
+   * item */
+  if (!LVAL_IS_FIXNUM(v) && (v->refcount > 1 || v->view)) {
+    lval *x = lval_ref(v->cell[i]);
+    lval_del(v);
+    return x;
+  }
   lval *x = lval_pop(v, i);
   lval_del(v);
   return x;
@@ -625,7 +4307,7 @@ void lval_expr_print(lval *v, char open, char close) {
   putchar(open);
 
   for (int i = 0; i < v->count; i++) {
-    lval_print(v->cell[i]);
+    lval_print(lval_index(v, i));
 
     // Don't print the trailing element
     if (i != (v->count - 1)) {
@@ -635,9 +4317,14 @@ void lval_expr_print(lval *v, char open, char close) {
   putchar(close);
 }
 
+/* Shallow copy: a new node whose children are shared with v */
 lval *lval_copy(lval *v) {
+  /* Fixnums are plain values, nothing to duplicate */
+  if (LVAL_IS_FIXNUM(v)) {
+    return v;
+  }
 
-  lval *x = malloc(sizeof(lval));
+  lval *x = lval_alloc();
   x->type = v->type;
 
   switch (v->type) {
@@ -652,86 +4339,229 @@ lval *lval_copy(lval *v) {
     /* Copy strings using mallox and strcpy */
 
   case LVAL_ERR:
-    x->err = malloc(strlen(v->err) + 1);
+    x->err = lval_mem_alloc(x, strlen(v->err) + 1);
     strcpy(x->err, v->err);
     break;
 
   case LVAL_SYM:
-    x->sym = malloc(strlen(v->sym) + 1);
-    strcpy(x->sym, v->sym);
+    x->sym = v->sym;
+    x->count = v->count;
+    break;
+
+  case LVAL_VEC:
+    x->count = v->count;
+    x->ints = lval_mem_alloc(x, sizeof(long) * (v->count ? v->count : 1));
+    memcpy(x->ints, v->ints, sizeof(long) * v->count);
+    break;
+
+  case LVAL_BIG:
+    x->count = v->count;
+    x->limbs = lval_mem_alloc(x, sizeof(uint32_t) * abs(v->count));
+    memcpy(x->limbs, v->limbs, sizeof(uint32_t) * abs(v->count));
     break;
 
-    /* Copy list by copying each sub-expression */
+    /* Copy list by referencing each sub-expression */
 
   case LVAL_QEXPR:
   case LVAL_SEXPR:
     x->count = v->count;
-    x->cell = malloc(sizeof(lval *) * v->count);
+    x->cell = NULL;
+    lval_cells_reserve(x, v->count);
     for (int i = 0; i < v->count; i++) {
-      x->cell[i] = lval_copy(v->cell[i]);
+      x->cell[i] = lval_ref(lval_index(v, i));
     }
     break;
   }
   return x;
 }
 
+lval *lval_ref(lval *v) {
+  if (!LVAL_IS_FIXNUM(v) && v->refcount < LVAL_REFCOUNT_MAX) {
+    v->refcount++;
+  }
+  return v;
+}
+
+/* Whether the caller holds the only reference to v and may change its
+ * cells. Old nodes are only mutated once the nursery has overflowed, and
+ * views, trees and compiled code never are. */
+int lval_mutable(lval *v) {
+  return LVAL_IS_FIXNUM(v) ||
+         (v->refcount == 1 && !v->view && !v->tree && !v->compiled &&
+          (LVAL_IS_YOUNG(v) || lnursery.overflowed));
+}
+
+/* Return a value equal to v that the caller may mutate in place */
+lval *lval_unshare(lval *v) {
+  if (lval_mutable(v)) {
+    return v;
+  }
+  lval *x = lval_copy(v);
+  lval_del(v);
+  return x;
+}
+
 /* ######################
  * ## ENV FUCNTIONS #####
  * ######################
  */
 
+/* Initial number of hash slots, always a power of two */
+#define LENV_MIN_SLOTS 64
+
 lenv *lenv_new(void) {
   lenv *e = malloc(sizeof(lenv));
 
   e->count = 0;
-  e->syms = NULL;
-  e->vals = NULL;
+  e->capacity = 0;
+  e->order = NULL;
+  e->nslots = LENV_MIN_SLOTS;
+  e->slots = calloc(e->nslots, sizeof(lbinding *));
   return e;
 }
 
 void lenv_del(lenv *v) {
 
   for (int i = 0; i < v->count; i++) {
-    free(v->syms[i]);
-    lval_del(v->vals[i]);
+    if (v->order[i]->val) {
+      lval_del(v->order[i]->val);
+    }
+    free(v->order[i]);
   }
-  free(v->vals);
-  free(v->syms);
+  free(v->order);
+  free(v->slots);
   free(v);
 }
 
+/* FNV-1a hash of a symbol name */
+unsigned int lsym_hash(char *s) {
+  unsigned int h = 2166136261u;
+  while (*s) {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/* Global table of interned symbol names */
+static struct {
+  int count;
+  int nslots;
+  lsymbol **slots;
+} lsymtab;
+
+/* Return the unique entry for the name s, adding it on first use */
+lsymbol *lsym_intern(char *s) {
+  unsigned int hash = lsym_hash(s);
+
+  if (lsymtab.count * 2 >= lsymtab.nslots) {
+    /* Double the table and reinsert every name */
+    int nslots = lsymtab.nslots ? lsymtab.nslots * 2 : 256;
+    lsymbol **slots = calloc(nslots, sizeof(lsymbol *));
+    for (int i = 0; i < lsymtab.nslots; i++) {
+      lsymbol *sym = lsymtab.slots[i];
+      if (sym) {
+        unsigned int j = sym->hash & (nslots - 1);
+        while (slots[j]) {
+          j = (j + 1) & (nslots - 1);
+        }
+        slots[j] = sym;
+      }
+    }
+    free(lsymtab.slots);
+    lsymtab.slots = slots;
+    lsymtab.nslots = nslots;
+  }
+
+  unsigned int mask = lsymtab.nslots - 1;
+  unsigned int i = hash & mask;
+  while (lsymtab.slots[i]) {
+    lsymbol *sym = lsymtab.slots[i];
+    if (sym->hash == hash && strcmp(sym->name, s) == 0) {
+      return sym;
+    }
+    i = (i + 1) & mask;
+  }
+
+  lsymbol *sym = malloc(sizeof(lsymbol) + strlen(s) + 1);
+  sym->hash = hash;
+  strcpy(sym->name, s);
+  lsymtab.slots[i] = sym;
+  lsymtab.count++;
+  return sym;
+}
+
+/* Find the slot holding sym, or the empty slot where it would go */
+lbinding **lenv_slot(lenv *e, char *sym, unsigned int hash) {
+  unsigned int mask = e->nslots - 1;
+  unsigned int i = hash & mask;
+  while (e->slots[i]) {
+    lbinding *b = e->slots[i];
+    if (b->sym == sym) {
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+  return &e->slots[i];
+}
+
+/* Double the slot table and reinsert every binding */
+void lenv_grow(lenv *e) {
+  free(e->slots);
+  e->nslots *= 2;
+  e->slots = calloc(e->nslots, sizeof(lbinding *));
+  for (int i = 0; i < e->count; i++) {
+    lbinding *b = e->order[i];
+    *lenv_slot(e, b->sym, b->hash) = b;
+  }
+}
+
 // lenv get function
 lval *lenv_get(lenv *e, lval *v) {
-  // iterate over e to look for v
-  for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], v->sym) == 0) {
-      return lval_copy(e->vals[i]);
-    }
+  lbinding *b = *lenv_slot(e, v->sym, v->count);
+  if (b && b->val) {
+    return lval_ref(b->val);
   }
   //  If no symbol found, return error
   return lval_err("unbound symbol '%s'", v->sym);
 }
 
 void lenv_put(lenv *e, lval *k, lval *v) {
+  lbinding *b = lenv_binding(e, k);
+  v = lval_promote(v);
+  /* Replace the value if the symbol is already bound */
+  if (b->val) {
+    lval_del(b->val);
+  }
+  b->val = v;
+}
 
-  /* Iterate and check if all items in enviromnent exists*/
-  for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      lval_del(e->vals[i]);
-      e->vals[i] = lval_copy(v);
-      return;
-    }
+/* Return the binding of the symbol k, adding an unbound one if there is
+ * none yet */
+lbinding *lenv_binding(lenv *e, lval *k) {
+  lbinding **slot = lenv_slot(e, k->sym, k->count);
+  if (*slot) {
+    return *slot;
   }
 
   /* If no exisiting entry is found, then allocate space for new entry */
-  e->count++;
-  e->vals = realloc(e->vals, sizeof(lval *) * e->count);
-  e->syms = realloc(e->syms, sizeof(char *) * e->count);
+  lbinding *b = malloc(sizeof(lbinding));
+  b->sym = k->sym;
+  b->hash = k->count;
+  b->val = NULL;
+  *slot = b;
 
-  /* copy the new value to vals and syms */
-  e->vals[e->count - 1] = lval_copy(v);
-  e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-  strcpy(e->syms[e->count - 1], k->sym);
+  if (e->count == e->capacity) {
+    e->capacity = e->capacity ? e->capacity * 2 : 16;
+    e->order = realloc(e->order, sizeof(lbinding *) * e->capacity);
+  }
+  e->order[e->count++] = b;
+
+  /* Keep the table at most half full so probe sequences stay short */
+  if (e->count * 2 > e->nslots) {
+    lenv_grow(e);
+  }
+  return b;
 }
 
 char *ltype_name(int i) {
@@ -748,15 +4578,19 @@ char *ltype_name(int i) {
     return "S-expression";
   case LVAL_QEXPR:
     return "Q-expression";
+  case LVAL_VEC:
+    return "Vector";
+  case LVAL_BIG:
+    return "Bignum";
   default:
     return "Unknown";
   }
 }
 
 void lval_print(lval *v) {
-  switch (v->type) {
+  switch (LVAL_TYPE(v)) {
   case LVAL_NUM:
-    printf("%li", v->num);
+    printf("%li", LVAL_NUM_VALUE(v));
     break;
   case LVAL_ERR:
     printf("Error: %s", v->err);
@@ -773,6 +4607,16 @@ void lval_print(lval *v) {
   case LVAL_FUN:
     printf("<Function>");
     break;
+  case LVAL_VEC:
+    putchar('[');
+    for (int i = 0; i < v->count; i++) {
+      printf(i ? " %li" : "%li", v->ints[i]);
+    }
+    putchar(']');
+    break;
+  case LVAL_BIG:
+    lbig_print(v);
+    break;
   }
 }
 